@@ -0,0 +1,221 @@
+/*
+ * Copyright (c) 2020 Sergey Ilinykh <rion4ik@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of mosquitto nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Loopback ping-pong latency benchmark. Compares reactor backends on round trip time of small
+// messages to an echo server running in a separate thread.
+//
+// usage: latency_bench [-n <round trips>] [-m <message size>] [reactor ...]
+// by default compares "epoll" with "epoll-busy".
+
+#include <algorithm>
+#include <array>
+#include <arpa/inet.h>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "reactor.h"
+#include "socket.h"
+
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+class EchoServer {
+public:
+    EchoServer()
+    {
+        _listenFd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr {};
+        addr.sin_family      = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t len        = sizeof(addr);
+        if (bind(_listenFd, reinterpret_cast<sockaddr *>(&addr), len) == -1
+            || listen(_listenFd, 1) == -1
+            || getsockname(_listenFd, reinterpret_cast<sockaddr *>(&addr), &len) == -1) {
+            perror("echo server");
+            exit(1);
+        }
+        _port   = ntohs(addr.sin_port);
+        _thread = std::thread([this]() { run(); });
+    }
+
+    ~EchoServer()
+    {
+        _thread.join();
+        close(_listenFd);
+    }
+
+    std::uint16_t port() const { return _port; }
+
+private:
+    void run()
+    {
+        int fd = accept(_listenFd, nullptr, nullptr);
+        if (fd == -1)
+            return;
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        char    buf[4096];
+        ssize_t n;
+        while ((n = ::read(fd, buf, sizeof(buf))) > 0) {
+            if (::write(fd, buf, n) != n)
+                break;
+        }
+        close(fd);
+    }
+
+    int           _listenFd = -1;
+    std::uint16_t _port     = 0;
+    std::thread   _thread;
+};
+
+struct Result {
+    std::string                  reactor;
+    std::vector<Clock::duration> rtt;
+};
+
+Result run(const std::string &reactorName, std::size_t roundTrips, std::size_t messageSize)
+{
+    Result result { reactorName, {} };
+    auto   reactor = TM::Reactor::factory(reactorName);
+    if (!reactor) {
+        std::cerr << "failed to find " << reactorName << " reactor\n";
+        exit(1);
+    }
+
+    EchoServer server;
+    auto       sock = std::make_shared<TM::Socket>();
+    sock->setReactor(reactor);
+    TM::SocketOptions options;
+    options.noDelay = true;
+    sock->setOptions(options);
+
+    const std::size_t warmup  = std::min<std::size_t>(roundTrips / 10, 1000);
+    const std::string message(messageSize, 'x');
+    std::size_t       pending = 0;
+    std::size_t       done    = 0;
+    Clock::time_point sent;
+
+    std::array<std::byte, TM::Device::ReadBufSz> buffer;
+    result.rtt.reserve(roundTrips);
+
+    auto ping = [&]() {
+        pending = message.size();
+        sent    = Clock::now();
+        sock->write(message);
+    };
+    sock->setReadyReadCallback([&]() {
+        auto len = sock->read(std::span<std::byte>(buffer));
+        if (!len || len > pending)
+            return;
+        pending -= len;
+        if (pending)
+            return;
+        if (done++ >= warmup)
+            result.rtt.push_back(Clock::now() - sent);
+        if (result.rtt.size() == roundTrips) {
+            sock->disconnect();
+            reactor->stop();
+            return;
+        }
+        ping();
+    });
+    sock->setConnectedCallback(ping);
+    sock->setDisconnectedCallback([&]() { reactor->stop(); });
+
+    sock->connect("127.0.0.1", server.port());
+    reactor->start();
+    return result;
+}
+
+void print(const Result &r)
+{
+    auto rtt = r.rtt;
+    if (rtt.empty()) {
+        std::cout << std::setw(20) << std::left << r.reactor << " failed\n";
+        return;
+    }
+    std::sort(rtt.begin(), rtt.end());
+    auto usec = [](Clock::duration d) {
+        return std::chrono::duration<double, std::micro>(d).count();
+    };
+    auto pct = [&](double p) { return usec(rtt[std::size_t(p * (rtt.size() - 1))]); };
+    Clock::duration total {};
+    for (auto d : rtt)
+        total += d;
+
+    std::cout << std::setw(20) << std::left << r.reactor << std::right << std::fixed
+              << std::setprecision(2) << std::setw(10) << usec(rtt.front()) << std::setw(10)
+              << pct(0.5) << std::setw(10) << pct(0.99) << std::setw(10) << pct(0.999)
+              << std::setw(10) << usec(total / rtt.size()) << "\n";
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    std::size_t              roundTrips  = 20000;
+    std::size_t              messageSize = 64;
+    std::vector<std::string> reactors;
+    int                      opt;
+    while ((opt = getopt(argc, argv, "n:m:h")) != -1) {
+        switch (opt) {
+        case 'n':
+            roundTrips = std::max(1ul, std::strtoul(optarg, nullptr, 10));
+            break;
+        case 'm':
+            messageSize = std::clamp<std::size_t>(std::strtoul(optarg, nullptr, 10), 1, 4096);
+            break;
+        default:
+            std::cout << "usage: " << argv[0]
+                      << " [-n <round trips>] [-m <message size>] [reactor ...]\n";
+            return 0;
+        }
+    }
+    for (int i = optind; i < argc; i++)
+        reactors.emplace_back(argv[i]);
+    if (reactors.empty())
+        reactors = { "epoll", "epoll-busy" };
+
+    std::cout << roundTrips << " round trips of " << messageSize << " bytes, usec\n"
+              << std::setw(20) << std::left << "reactor" << std::right << std::setw(10) << "min"
+              << std::setw(10) << "p50" << std::setw(10) << "p99" << std::setw(10) << "p99.9"
+              << std::setw(10) << "avg" << "\n";
+    for (auto const &name : reactors)
+        print(run(name, roundTrips, messageSize));
+    return 0;
+}
@@ -0,0 +1,250 @@
+/*
+ * Copyright (c) 2020 Sergey Ilinykh <rion4ik@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of mosquitto nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Loopback TLS throughput benchmark. A server thread with a self-signed certificate streams a
+// fixed amount of data over a fresh connection, the client (TM::SecureSocket) reads it and the
+// rate is measured from the end of the handshake till the end of the stream. Compares record
+// crypto in user space with kTLS (TlsContext::Config::kernelTls, enabled on both sides).
+//
+// usage: tls_bench [-s <megabytes>] [-r <rounds>] [-2] [mode ...]
+// modes: user, ktls. -2 limits the server to tls 1.2: some openssl versions offload only the
+// tls 1.2 receive path. kTLS needs the kernel tls module (modprobe tls), the tx/rx columns tell
+// what was actually offloaded on the client.
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <array>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include <openssl/ec.h>
+#include <openssl/evp.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+
+#include "log.h"
+#include "reactor.h"
+#include "securesocket.h"
+#include "tlscontext.h"
+
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+// sends size bytes to every client, then closes the connection
+class TlsServer {
+public:
+    TlsServer(std::size_t size, bool kernelTls, bool tls12) : _size(size)
+    {
+        _ctx = SSL_CTX_new(TLS_server_method());
+        useSelfSigned();
+        if (kernelTls)
+            SSL_CTX_set_options(_ctx, SSL_OP_ENABLE_KTLS);
+        if (tls12)
+            SSL_CTX_set_max_proto_version(_ctx, TLS1_2_VERSION);
+
+        _listenFd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr {};
+        addr.sin_family      = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t len        = sizeof(addr);
+        if (bind(_listenFd, reinterpret_cast<sockaddr *>(&addr), len) == -1
+            || listen(_listenFd, 16) == -1
+            || getsockname(_listenFd, reinterpret_cast<sockaddr *>(&addr), &len) == -1) {
+            perror("tls server");
+            exit(1);
+        }
+        _port   = ntohs(addr.sin_port);
+        _thread = std::thread([this]() { run(); });
+    }
+
+    ~TlsServer()
+    {
+        shutdown(_listenFd, SHUT_RDWR);
+        _thread.join();
+        close(_listenFd);
+        SSL_CTX_free(_ctx);
+    }
+
+    std::uint16_t port() const { return _port; }
+
+private:
+    void useSelfSigned()
+    {
+        EVP_PKEY *key  = nullptr;
+        auto      pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr);
+        EVP_PKEY_keygen_init(pctx);
+        EVP_PKEY_CTX_set_ec_paramgen_curve_nid(pctx, NID_X9_62_prime256v1);
+        EVP_PKEY_keygen(pctx, &key);
+        EVP_PKEY_CTX_free(pctx);
+
+        X509 *cert = X509_new();
+        ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+        X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+        X509_gmtime_adj(X509_getm_notAfter(cert), 3600);
+        X509_set_pubkey(cert, key);
+        auto name = X509_get_subject_name(cert);
+        X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+                                   reinterpret_cast<const unsigned char *>("localhost"), -1, -1, 0);
+        X509_set_issuer_name(cert, name);
+        X509_sign(cert, key, EVP_sha256());
+        SSL_CTX_use_certificate(_ctx, cert);
+        SSL_CTX_use_PrivateKey(_ctx, key);
+        X509_free(cert);
+        EVP_PKEY_free(key);
+    }
+
+    void run()
+    {
+        const std::vector<char> chunk(65536, 'x');
+        int                     fd;
+        while ((fd = accept(_listenFd, nullptr, nullptr)) != -1) {
+            SSL *ssl = SSL_new(_ctx);
+            SSL_set_fd(ssl, fd);
+            if (SSL_accept(ssl) == 1) {
+                for (std::size_t sent = 0; sent < _size;) {
+                    int n = SSL_write(ssl, chunk.data(), int(std::min(chunk.size(), _size - sent)));
+                    if (n <= 0)
+                        break;
+                    sent += std::size_t(n);
+                }
+                SSL_shutdown(ssl);
+            }
+            SSL_free(ssl);
+            close(fd);
+        }
+    }
+
+    SSL_CTX *     _ctx;
+    std::size_t   _size;
+    int           _listenFd = -1;
+    std::uint16_t _port     = 0;
+    std::thread   _thread;
+};
+
+struct Result {
+    std::string     mode;
+    std::size_t     bytes = 0;
+    Clock::duration time {};
+    bool            kernelSend = false;
+    bool            kernelRecv = false;
+};
+
+Result run(const std::string &mode, std::size_t size, std::size_t rounds, bool tls12)
+{
+    Result                 result { mode };
+    TM::TlsContext::Config config;
+    config.kernelTls = mode == "ktls";
+    auto      context = std::make_shared<TM::TlsContext>(config);
+    auto      reactor = TM::Reactor::factory("epoll");
+    TlsServer server(size, config.kernelTls, tls12);
+
+    std::array<std::byte, 65536> buffer;
+    for (std::size_t i = 0; i < rounds; i++) {
+        auto              sock     = std::make_shared<TM::SecureSocket>();
+        std::size_t       received = 0;
+        Clock::time_point start;
+        sock->setReactor(reactor);
+        sock->setTlsContext(context);
+        sock->setConnectedCallback([&]() {
+            start             = Clock::now();
+            result.kernelSend = sock->kernelTlsSend();
+            result.kernelRecv = sock->kernelTlsReceive();
+        });
+        sock->setReadyReadCallback(
+            [&]() { received += sock->read(std::span<std::byte>(buffer)); });
+        sock->setDisconnectedCallback([&]() { reactor->stop(); });
+        sock->connect("127.0.0.1", server.port());
+        reactor->start();
+
+        if (received != size) {
+            std::cerr << mode << ": got " << received << " bytes of " << size << "\n";
+            exit(1);
+        }
+        result.bytes += received;
+        result.time += Clock::now() - start;
+    }
+    return result;
+}
+
+void print(const Result &r)
+{
+    auto seconds = std::chrono::duration<double>(r.time).count();
+    std::cout << std::setw(10) << std::left << r.mode << std::right << std::fixed
+              << std::setprecision(1) << std::setw(12) << r.bytes / seconds / (1 << 20)
+              << std::setw(6) << (r.kernelSend ? "yes" : "no") << std::setw(6)
+              << (r.kernelRecv ? "yes" : "no") << "\n";
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    std::size_t              megabytes = 256;
+    std::size_t              rounds    = 4;
+    bool                     tls12     = false;
+    std::vector<std::string> modes;
+    int                      opt;
+    while ((opt = getopt(argc, argv, "s:r:2h")) != -1) {
+        switch (opt) {
+        case 's':
+            megabytes = std::max(1ul, std::strtoul(optarg, nullptr, 10));
+            break;
+        case 'r':
+            rounds = std::max(1ul, std::strtoul(optarg, nullptr, 10));
+            break;
+        case '2':
+            tls12 = true;
+            break;
+        default:
+            std::cout << "usage: " << argv[0]
+                      << " [-s <megabytes>] [-r <rounds>] [-2] [mode ...]\n";
+            return 0;
+        }
+    }
+    for (int i = optind; i < argc; i++)
+        modes.emplace_back(argv[i]);
+    if (modes.empty())
+        modes = { "user", "ktls" };
+
+    TM::Log::setEnabled(false); // records are traced otherwise
+    std::cout << rounds << " x " << megabytes << " MB over loopback tls\n"
+              << std::setw(10) << std::left << "mode" << std::right << std::setw(12) << "MB/s"
+              << std::setw(6) << "tx" << std::setw(6) << "rx" << "\n";
+    for (auto const &name : modes)
+        print(run(name, megabytes << 20, rounds, tls12));
+    return 0;
+}
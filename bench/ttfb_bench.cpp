@@ -0,0 +1,252 @@
+/*
+ * Copyright (c) 2020 Sergey Ilinykh <rion4ik@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of mosquitto nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Loopback time-to-first-byte benchmark of the tcp tuning options (TM::SocketOptions). Every
+// round opens a new connection, sends a request in two writes (like headers and a body) and
+// measures the time from connect() till the first byte of the response.
+//
+// usage: ttfb_bench [-n <connections>] [profile ...]
+// profiles: default, nodelay, quickack, buffers, user-timeout, fastopen, all. by default all of
+// them are compared. fast open needs the server bit of net.ipv4.tcp_fastopen (e.g. 3), the
+// syn-data column tells how many requests actually went with the SYN.
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "reactor.h"
+#include "socket.h"
+
+using Clock = std::chrono::steady_clock;
+using namespace std::chrono_literals;
+
+namespace {
+
+const std::string RequestHead = "GET / HTTP/1.1\r\nHost: localhost\r\nContent-Length: 4\r\n\r\n";
+const std::string RequestBody = "ping";
+const std::string Response    = "HTTP/1.1 200 OK\r\nContent-Length: 4\r\n\r\npong";
+
+// answers every request after reading it completely and closes the connection
+class HttpServer {
+public:
+    HttpServer()
+    {
+        _listenFd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr {};
+        addr.sin_family      = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t len        = sizeof(addr);
+        int       qlen       = 128;
+        setsockopt(_listenFd, IPPROTO_TCP, TCP_FASTOPEN, &qlen, sizeof(qlen));
+        if (bind(_listenFd, reinterpret_cast<sockaddr *>(&addr), len) == -1
+            || listen(_listenFd, 128) == -1
+            || getsockname(_listenFd, reinterpret_cast<sockaddr *>(&addr), &len) == -1) {
+            perror("http server");
+            exit(1);
+        }
+        _port   = ntohs(addr.sin_port);
+        _thread = std::thread([this]() { run(); });
+    }
+
+    ~HttpServer()
+    {
+        shutdown(_listenFd, SHUT_RDWR); // wakes up accept()
+        _thread.join();
+        close(_listenFd);
+    }
+
+    std::uint16_t port() const { return _port; }
+
+private:
+    void run()
+    {
+        int fd;
+        while ((fd = accept(_listenFd, nullptr, nullptr)) != -1) {
+            std::string request;
+            char        buf[1024];
+            ssize_t     n;
+            while (request.size() < RequestHead.size() + RequestBody.size()
+                   && (n = ::read(fd, buf, sizeof(buf))) > 0)
+                request.append(buf, std::size_t(n));
+            ::write(fd, Response.data(), Response.size());
+            close(fd);
+        }
+    }
+
+    int           _listenFd = -1;
+    std::uint16_t _port     = 0;
+    std::thread   _thread;
+};
+
+struct Result {
+    std::string                  profile;
+    std::vector<Clock::duration> ttfb;
+    std::size_t                  synData = 0;
+};
+
+std::map<std::string, TM::SocketOptions> profiles()
+{
+    std::map<std::string, TM::SocketOptions> ret;
+    ret["default"];
+    ret["nodelay"].noDelay  = true;
+    ret["quickack"].quickAck = true;
+    ret["buffers"].receiveBuffer = ret["buffers"].sendBuffer = 256 * 1024;
+    ret["user-timeout"].userTimeout                          = 5s;
+    ret["fastopen"].fastOpen                                 = true;
+
+    auto &all         = ret["all"];
+    all.noDelay       = true;
+    all.quickAck      = true;
+    all.receiveBuffer = all.sendBuffer = 256 * 1024;
+    all.userTimeout                    = 5s;
+    all.fastOpen                       = true;
+    return ret;
+}
+
+Result run(const std::string &profile, const TM::SocketOptions &options, std::size_t connections)
+{
+    Result     result { profile, {} };
+    auto       reactor = TM::Reactor::factory("epoll");
+    HttpServer server;
+
+    std::shared_ptr<TM::Socket> sock;
+    Clock::time_point           started;
+    bool                        gotFirst = false;
+    std::size_t                 done     = 0;
+
+    std::function<void()> next = [&]() {
+        if (done++ == connections) {
+            reactor->stop();
+            return;
+        }
+        sock = std::make_shared<TM::Socket>();
+        sock->setReactor(reactor);
+        sock->setOptions(options);
+        sock->setConnectedCallback([&]() {
+            sock->write(RequestHead);
+            sock->write(RequestBody);
+        });
+        sock->setReadyReadCallback([&]() {
+            char buf[256];
+            auto len = sock->read(std::as_writable_bytes(std::span<char>(buf)));
+            if (len && !gotFirst) {
+                gotFirst = true;
+                result.ttfb.push_back(Clock::now() - started);
+                tcp_info  info {};
+                socklen_t infoLen = sizeof(info);
+                if (getsockopt(sock->fileDescriptor(), IPPROTO_TCP, TCP_INFO, &info, &infoLen) == 0
+                    && info.tcpi_options & TCPI_OPT_SYN_DATA)
+                    result.synData++;
+            }
+        });
+        sock->setDisconnectedCallback([&]() {
+            // a new connection from within the callback of the old one is fine, it's not reused
+            reactor->post([&]() { next(); });
+        });
+        gotFirst = false;
+        started  = Clock::now();
+        sock->connect("127.0.0.1", server.port());
+    };
+    next();
+    reactor->start();
+    if (sock)
+        sock->disconnect();
+    return result;
+}
+
+void print(const Result &r)
+{
+    auto ttfb = r.ttfb;
+    if (ttfb.empty()) {
+        std::cout << std::setw(14) << std::left << r.profile << " failed\n";
+        return;
+    }
+    std::sort(ttfb.begin(), ttfb.end());
+    auto usec = [](Clock::duration d) {
+        return std::chrono::duration<double, std::micro>(d).count();
+    };
+    auto pct = [&](double p) { return usec(ttfb[std::size_t(p * (ttfb.size() - 1))]); };
+    Clock::duration total {};
+    for (auto d : ttfb)
+        total += d;
+
+    std::cout << std::setw(14) << std::left << r.profile << std::right << std::fixed
+              << std::setprecision(2) << std::setw(10) << usec(ttfb.front()) << std::setw(10)
+              << pct(0.5) << std::setw(10) << pct(0.99) << std::setw(10)
+              << usec(total / ttfb.size()) << std::setw(10) << r.synData << "\n";
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    std::size_t              connections = 2000;
+    std::vector<std::string> selected;
+    int                      opt;
+    while ((opt = getopt(argc, argv, "n:h")) != -1) {
+        switch (opt) {
+        case 'n':
+            connections = std::max(1ul, std::strtoul(optarg, nullptr, 10));
+            break;
+        default:
+            std::cout << "usage: " << argv[0] << " [-n <connections>] [profile ...]\n";
+            return 0;
+        }
+    }
+    auto all = profiles();
+    for (int i = optind; i < argc; i++)
+        selected.emplace_back(argv[i]);
+    if (selected.empty())
+        selected = { "default", "nodelay", "quickack", "buffers", "user-timeout", "fastopen",
+                     "all" };
+
+    std::cout << connections << " connections, time to first byte in usec\n"
+              << std::setw(14) << std::left << "profile" << std::right << std::setw(10) << "min"
+              << std::setw(10) << "p50" << std::setw(10) << "p99" << std::setw(10) << "avg"
+              << std::setw(10) << "syn-data" << "\n";
+    for (auto const &name : selected) {
+        auto it = all.find(name);
+        if (it == all.end()) {
+            std::cerr << "unknown profile " << name << "\n";
+            return 1;
+        }
+        print(run(name, it->second, connections));
+    }
+    return 0;
+}
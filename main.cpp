@@ -1,3 +1,4 @@
+#include <fcntl.h>
 #include <iostream>
 #include <unistd.h>
 
@@ -10,39 +11,76 @@ using namespace std;
 
 int main(int argc, char *argv[])
 {
-    int opt;
-    while ((opt = getopt(argc, argv, "vh")) > 0)
+    int         opt;
+    std::string reactorName = "epoll";
+    bool        printStats  = false;
+    std::string archivePath;
+    while ((opt = getopt(argc, argv, "vhsr:o:")) > 0)
         switch (opt) {
         case 'v':
             TM::Log::setEnabled(true);
             break;
 
+        case 'r':
+            reactorName = optarg;
+            break;
+
+        case 's':
+            printStats = true;
+            break;
+
+        case 'o':
+            archivePath = optarg;
+            break;
+
         case 'h':
         default:
             std::cout << R"(
  -v  - enable verbose mode
+ -r  - reactor to use: epoll (default), epoll-et, epoll-busy or epoll-busy:<usec>,
+       io_uring, io_uring-sqpoll, pool or pool:<threads>
+ -s  - print reactor statistics on exit
+ -o  - save the page to the file instead of extracting the brief
  -h  - show this help
 )";
             break;
         }
 
-    auto reactor = TM::Reactor::factory("epoll");
+    auto reactor = TM::Reactor::factory(reactorName);
     if (!reactor) {
-        std::cerr << "failed to find epoll reactor\n";
+        std::cerr << "failed to find " << reactorName << " reactor\n";
         return -1;
     }
+    reactor->setStatsEnabled(printStats);
 
     bool        finished = false;
     std::string url      = "http://time.com";
     auto        client   = std::make_shared<TM::HttpClient>(reactor, url);
-    client->execute([&](const std::string &data) {
+    client->setTimeout(std::chrono::seconds(30));
+
+    int archiveFd = -1;
+    if (!archivePath.empty()) {
+        archiveFd = open(archivePath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (archiveFd == -1) {
+            std::cerr << "failed to open " << archivePath << "\n";
+            return -1;
+        }
+        client->setOutput(archiveFd);
+    }
+
+    client->execute([&](TM::BufferChain &&data) {
         finished = true;
         reactor->stop();
-        if (data.empty()) {
+        if (archiveFd != -1) {
+            if (client->completed())
+                std::cout << client->bodyWritten() << " bytes saved to " << archivePath << "\n";
+            else
+                std::cout << "failed to save the page. try verbose (-v) mode\n" << std::flush;
+        } else if (data.empty()) {
             std::cout << "got empty contents. try verbose (-v) mode\n" << std::flush;
         } else {
             try {
-                std::cout << TM::BriefExtractor::extract(data, url) << "\n";
+                std::cout << TM::BriefExtractor::extract(data.contiguous(), url) << "\n";
             } catch (std::exception &e) {
                 std::cerr << "There was an error extracting brief: " << e.what() << "\n";
             }
@@ -52,5 +90,10 @@ int main(int argc, char *argv[])
     if (!finished)
         reactor->start();
 
+    if (printStats)
+        std::cerr << reactor->stats();
+    if (archiveFd != -1)
+        close(archiveFd);
+
     return 0;
 }
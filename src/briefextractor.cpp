@@ -8,15 +8,15 @@
 
 namespace TM {
 
-std::string BriefExtractor::extractDiv(const std::string &data, std::size_t startPos)
+std::string BriefExtractor::extractDiv(std::string_view data, std::size_t startPos)
 {
     int  level = 1;
     auto idx   = startPos;
     while (level > 0) {
         idx = data.find("div", idx);
-        if (idx == std::string::npos) {
+        if (idx == std::string_view::npos) {
             // check if we exited all internal divs
-            return level == 1 ? data.substr(startPos) : std::string();
+            return level == 1 ? std::string(data.substr(startPos)) : std::string();
         }
         // make sure it's opening or closing tag
         bool isOpen = idx > 0 && data[idx - 1] == '<';
@@ -34,7 +34,7 @@ std::string BriefExtractor::extractDiv(const std::string &data, std::size_t star
         idx++;
     }
     idx -= 3; // on the position of outside closing div
-    auto ret = data.substr(startPos, idx - startPos);
+    std::string ret(data.substr(startPos, idx - startPos));
     str::trim(ret);
     return ret;
 }
@@ -87,10 +87,10 @@ std::string BriefExtractor::linksToJson(const Links &links)
     return "{ news: [ " + ret.str() + "]}";
 }
 
-std::string BriefExtractor::extract(const std::string &html, const std::string &base_url)
+std::string BriefExtractor::extract(std::string_view html, const std::string &base_url)
 {
     auto idx = html.find(">The Brief<");
-    if (idx == std::string::npos || (idx = html.find("</div>", idx)) == std::string::npos)
+    if (idx == std::string_view::npos || (idx = html.find("</div>", idx)) == std::string_view::npos)
         throw NoValidBrief("\"The Brief\" not found");
 
     auto div = extractDiv(html, idx + 6);
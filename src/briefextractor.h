@@ -3,6 +3,7 @@
 
 #include <map>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace TM {
@@ -11,10 +12,10 @@ class BriefExtractor {
 public:
     using Links = std::vector<std::pair<std::string, std::string>>;
 
-    static std::string extractDiv(const std::string &data, std::size_t startPos = 0);
+    static std::string extractDiv(std::string_view data, std::size_t startPos = 0);
     static Links       links(const std::string &data, const std::string &base_url);
     static std::string linksToJson(const Links &links);
-    static std::string extract(const std::string &html, const std::string &base_url);
+    static std::string extract(std::string_view html, const std::string &base_url);
 };
 
 } // namespace TM
@@ -0,0 +1,226 @@
+/*
+ * Copyright (c) 2020 Sergey Ilinykh <rion4ik@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of mosquitto nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#include "bufferchain.h"
+
+namespace TM {
+
+struct BufferChain::Block {
+    explicit Block(std::size_t capacity) : data(new char[capacity]), capacity(capacity) { }
+
+    std::unique_ptr<char[]> data; // left uninitialized, it's overwritten anyway
+    std::size_t             capacity;
+    std::size_t             used = 0;
+};
+
+std::string_view BufferChain::Slice::view() const
+{
+    return std::string_view(_block->data.get() + _offset, _size);
+}
+
+BufferChain::BufferChain(std::string_view data)
+{
+    auto space = prepare(data.size());
+    std::memcpy(space.data(), data.data(), data.size());
+    commit(data.size());
+}
+
+BufferChain::BufferChain(const BufferChain &other) : _slices(other._slices), _size(other._size)
+{
+}
+
+BufferChain::BufferChain(BufferChain &&other) noexcept :
+    _slices(std::move(other._slices)), _tail(std::move(other._tail)),
+    _size(std::exchange(other._size, 0))
+{
+}
+
+BufferChain &BufferChain::operator=(const BufferChain &other)
+{
+    if (this != &other) {
+        _slices = other._slices;
+        _tail.reset();
+        _size = other._size;
+    }
+    return *this;
+}
+
+BufferChain &BufferChain::operator=(BufferChain &&other) noexcept
+{
+    _slices = std::move(other._slices);
+    _tail   = std::move(other._tail);
+    _size   = std::exchange(other._size, 0);
+    other._slices.clear();
+    return *this;
+}
+
+std::span<char> BufferChain::prepare(std::size_t size)
+{
+    if (!_tail || _tail->capacity - _tail->used < size)
+        _tail = std::make_shared<Block>(std::max(size, BlockSz));
+    return std::span<char>(_tail->data.get() + _tail->used, _tail->capacity - _tail->used);
+}
+
+void BufferChain::commit(std::size_t size)
+{
+    if (!size)
+        return;
+    // grow the last slice if it ends right where the new data starts
+    if (!_slices.empty() && _slices.back()._block == _tail
+        && _slices.back()._offset + _slices.back()._size == _tail->used)
+        _slices.back()._size += size;
+    else
+        _slices.push_back(Slice(_tail, _tail->used, size));
+    _tail->used += size;
+    _size += size;
+}
+
+void BufferChain::append(const BufferChain &other)
+{
+    _slices.insert(_slices.end(), other._slices.begin(), other._slices.end());
+    _size += other._size;
+}
+
+void BufferChain::reserve(std::size_t size)
+{
+    if (size <= _size)
+        return;
+    // already in the tail block with enough room after it
+    bool inTail = _slices.empty()
+        || (_slices.size() == 1 && _slices.front()._block == _tail
+            && _slices.front()._offset + _slices.front()._size == _tail->used);
+    if (inTail && _tail && _tail->capacity - _tail->used >= size - _size)
+        return;
+    coalesce(size);
+}
+
+void BufferChain::coalesce(std::size_t capacity)
+{
+    auto block = std::make_shared<Block>(capacity);
+    for (auto const &slice : _slices) {
+        std::memcpy(block->data.get() + block->used, slice.view().data(), slice.size());
+        block->used += slice.size();
+    }
+    _slices.clear();
+    if (block->used)
+        _slices.push_back(Slice(block, 0, block->used));
+    _tail = std::move(block);
+}
+
+bool BufferChain::matchesAt(std::size_t slice, std::size_t pos, std::string_view needle) const
+{
+    for (; slice < _slices.size() && !needle.empty(); slice++, pos = 0) {
+        auto part = _slices[slice].view().substr(pos, needle.size());
+        if (needle.compare(0, part.size(), part) != 0)
+            return false;
+        needle.remove_prefix(part.size());
+    }
+    return needle.empty();
+}
+
+std::size_t BufferChain::find(std::string_view needle, std::size_t from) const
+{
+    if (needle.empty())
+        return from <= _size ? from : npos;
+
+    std::size_t base = 0;
+    for (std::size_t i = 0; i < _slices.size(); base += _slices[i++].size()) {
+        auto view = _slices[i].view();
+        if (from >= base + view.size())
+            continue;
+        auto start = from > base ? from - base : 0;
+        // a match inside the slice is always earlier than one crossing into the next slices
+        auto idx = view.find(needle, start);
+        if (idx != npos)
+            return base + idx;
+        auto crossing = view.size() >= needle.size() ? view.size() - needle.size() + 1 : 0;
+        for (auto pos = std::max(start, crossing); pos < view.size(); pos++)
+            if (matchesAt(i, pos, needle))
+                return base + pos;
+    }
+    return npos;
+}
+
+BufferChain BufferChain::split(std::size_t size)
+{
+    BufferChain head;
+    size = std::min(size, _size);
+    head._size = size;
+    _size -= size;
+    while (size) {
+        auto &front = _slices.front();
+        if (front._size <= size) {
+            size -= front._size;
+            head._slices.push_back(std::move(front));
+            _slices.pop_front();
+        } else {
+            head._slices.push_back(Slice(front._block, front._offset, size));
+            front._offset += size;
+            front._size -= size;
+            size = 0;
+        }
+    }
+    return head;
+}
+
+void BufferChain::consume(std::size_t size)
+{
+    split(size);
+    if (!_size && _tail && _tail.use_count() == 1)
+        _tail->used = 0;
+}
+
+std::string_view BufferChain::contiguous()
+{
+    if (_slices.size() > 1)
+        coalesce(_size);
+    return _slices.empty() ? std::string_view() : _slices.front().view();
+}
+
+std::string BufferChain::toString() const
+{
+    std::string ret;
+    ret.reserve(_size);
+    for (auto const &slice : _slices)
+        ret += slice.view();
+    return ret;
+}
+
+void BufferChain::clear()
+{
+    _slices.clear();
+    _tail.reset();
+    _size = 0;
+}
+
+} // namespace TM
@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) 2020 Sergey Ilinykh <rion4ik@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of mosquitto nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef BUFFERCHAIN_H
+#define BUFFERCHAIN_H
+
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+
+namespace TM {
+
+/**
+ * @brief BufferChain is a sequence of slices of reference counted memory blocks.
+ *
+ * Data is read right into the free tail of the last block (prepare/commit), and passing parts
+ * of it around (split, copying the chain) shares the blocks instead of copying bytes. Only the
+ * chain which allocated a block appends to it, so the bytes a slice refers to never change.
+ * Consumers which need contiguous memory get it for free if everything landed into one block,
+ * e.g. after reserve() with the known total size. Otherwise contiguous() copies once.
+ */
+class BufferChain {
+public:
+    static constexpr std::size_t BlockSz = 16384; // the smallest block allocated by prepare()
+    static constexpr std::size_t npos    = std::string_view::npos;
+
+    class Slice;
+
+    BufferChain() = default;
+    explicit BufferChain(std::string_view data);
+    // the copy shares the bytes but appends to its own blocks
+    BufferChain(const BufferChain &other);
+    BufferChain(BufferChain &&other) noexcept;
+    BufferChain &operator=(const BufferChain &other);
+    BufferChain &operator=(BufferChain &&other) noexcept;
+
+    std::size_t size() const { return _size; }
+    bool        empty() const { return !_size; }
+
+    // gather view of the data
+    const std::deque<Slice> &slices() const { return _slices; }
+
+    // writable space of at least size bytes after the data. it's appended by commit()
+    std::span<char> prepare(std::size_t size);
+    void            commit(std::size_t size);
+
+    // shares the other's bytes
+    void append(const BufferChain &other);
+
+    // makes room for the data to grow up to size bytes in one block. what's there already is
+    // copied, so it's cheapest before or right after the first read
+    void reserve(std::size_t size);
+
+    std::size_t find(std::string_view needle, std::size_t from = 0) const;
+
+    // removes the first size bytes and returns them as a chain of their own. nothing is copied
+    BufferChain split(std::size_t size);
+    // drops the first size bytes. once the chain is empty its tail block is rewound for reuse,
+    // unless some other chain still refers to it, so a steady read/consume cycle (e.g. a
+    // receive buffer) doesn't allocate
+    void consume(std::size_t size);
+
+    // the whole data in one piece. copies it into a new block if it's fragmented
+    std::string_view contiguous();
+    std::string      toString() const;
+    void             clear();
+
+private:
+    struct Block;
+
+    bool matchesAt(std::size_t slice, std::size_t pos, std::string_view needle) const;
+    void coalesce(std::size_t capacity);
+
+    std::deque<Slice>      _slices;
+    std::shared_ptr<Block> _tail; // the block commit() appends to
+    std::size_t            _size = 0;
+};
+
+class BufferChain::Slice {
+public:
+    std::string_view view() const;
+    std::size_t      size() const { return _size; }
+
+private:
+    friend class BufferChain;
+
+    Slice(std::shared_ptr<Block> block, std::size_t offset, std::size_t size) :
+        _block(std::move(block)), _offset(offset), _size(size)
+    {
+    }
+
+    std::shared_ptr<Block> _block;
+    std::size_t            _offset;
+    std::size_t            _size;
+};
+
+} // namespace TM
+
+#endif // BUFFERCHAIN_H
@@ -0,0 +1,245 @@
+/*
+ * Copyright (c) 2020 Sergey Ilinykh <rion4ik@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of mosquitto nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <sys/socket.h>
+
+#include "connectionpool.h"
+#include "log.h"
+#include "reactor_loop.h"
+#include "socket.h"
+
+namespace TM {
+
+// still connected, and nothing came from the peer since the last response
+static bool healthy(Socket &socket)
+{
+    if (socket.fileDescriptor() == -1 || socket.atEnd())
+        return false;
+    if (!socket.bytesAvailable()) {
+        // FIONREAD doesn't tell a closed connection from an idle one
+        char byte;
+        auto n = ::recv(socket.fileDescriptor(), &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+        return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+    }
+    // tls records like session tickets decrypt to nothing. anything else is a response nobody
+    // asked for (e.g. 408), so the connection is out of sync with the requests
+    std::byte data;
+    return socket.read(std::span<std::byte>(&data, 1)) == 0 && !socket.atEnd()
+        && socket.fileDescriptor() != -1;
+}
+
+// the socket's callbacks and timer belong to its reactor thread
+static bool onOwnThread(const Socket &socket)
+{
+    auto loop = dynamic_cast<ReactorLoop *>(socket.reactor().get());
+    return !loop || loop->isInLoopThread();
+}
+
+struct ConnectionPool::Private {
+    struct Idle {
+        std::shared_ptr<Socket>  socket;
+        std::shared_ptr<Reactor> owner; // of the requests, the socket's one may be its loop
+        Reactor::TimerId         timer = Reactor::InvalidTimer;
+    };
+
+    Config                                  config;
+    mutable std::mutex                      mutex;
+    std::map<std::string, std::deque<Idle>> idle; // the most recent last
+
+    // called on the socket's thread while it's parked
+    void expire(const std::string &key, Socket *socket, bool check);
+    // drops the pool's callbacks along with the timer, so nothing refers to the pool anymore
+    static void close(Idle idle);
+};
+
+void ConnectionPool::Private::close(Idle idle)
+{
+    auto reactor = idle.socket->reactor();
+    bool own     = onOwnThread(*idle.socket);
+    auto doClose = [idle = std::move(idle)]() {
+        if (idle.timer != Reactor::InvalidTimer)
+            idle.socket->reactor()->cancelTimer(idle.timer);
+        idle.socket->setReadyReadCallback(nullptr);
+        idle.socket->setDisconnectedCallback(nullptr);
+        idle.socket->disconnect();
+    };
+    if (own)
+        doClose();
+    else
+        reactor->post(std::move(doClose));
+}
+
+void ConnectionPool::Private::expire(const std::string &key, Socket *socket, bool check)
+{
+    if (check && healthy(*socket))
+        return;
+    Idle entry;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto                        it = idle.find(key);
+        if (it == idle.end())
+            return;
+        auto &list  = it->second;
+        auto  found = std::find_if(list.begin(), list.end(), [socket](const Idle &parked) {
+            return parked.socket.get() == socket;
+        });
+        if (found == list.end())
+            return;
+        entry = std::move(*found);
+        list.erase(found);
+        if (list.empty())
+            idle.erase(it);
+    }
+    // the socket may be running this callback. the loop keeps it alive till the iteration ends
+    if (entry.timer != Reactor::InvalidTimer)
+        entry.socket->reactor()->cancelTimer(entry.timer);
+    entry.socket->disconnect();
+}
+
+ConnectionPool::ConnectionPool() : ConnectionPool(Config()) { }
+
+ConnectionPool::ConnectionPool(const Config &config) : d(std::make_shared<Private>())
+{
+    d->config = config;
+}
+
+ConnectionPool::~ConnectionPool() { clear(); }
+
+const ConnectionPool::Config &ConnectionPool::config() const { return d->config; }
+
+std::shared_ptr<Socket> ConnectionPool::take(const std::string &key,
+                                             const std::shared_ptr<Reactor> &reactor)
+{
+    while (true) {
+        Private::Idle idle;
+        {
+            std::lock_guard<std::mutex> lock(d->mutex);
+            auto                        it = d->idle.find(key);
+            if (it == d->idle.end())
+                return nullptr;
+            auto &list   = it->second;
+            auto  usable = [&reactor](const Private::Idle &idle) {
+                return idle.owner == reactor && onOwnThread(*idle.socket);
+            };
+            auto found = std::find_if(list.rbegin(), list.rend(), usable);
+            if (found == list.rend())
+                return nullptr;
+            idle = std::move(*found);
+            list.erase(std::next(found).base());
+            if (list.empty())
+                d->idle.erase(it);
+        }
+
+        auto &socket = idle.socket;
+        if (idle.timer != Reactor::InvalidTimer)
+            socket->reactor()->cancelTimer(idle.timer);
+        socket->setConnectedCallback(nullptr);
+        socket->setReadyReadCallback(nullptr);
+        socket->setReadyWriteCallback(nullptr);
+        socket->setDisconnectedCallback(nullptr);
+        if (healthy(*socket))
+            return socket;
+        Log("Dropped stale connection to ") << key;
+        socket->disconnect();
+    }
+}
+
+void ConnectionPool::put(const std::string &key, const std::shared_ptr<Reactor> &reactor,
+                         std::shared_ptr<Socket> socket)
+{
+    if (!healthy(*socket)) {
+        socket->disconnect();
+        return;
+    }
+
+    // nothing is expected from the peer till the next request. data or eof means it's gone
+    auto raw    = socket.get();
+    auto expire = [weak = std::weak_ptr<Private>(d), key, raw](bool check) {
+        if (auto pool = weak.lock())
+            pool->expire(key, raw, check);
+    };
+    socket->setConnectedCallback(nullptr);
+    socket->setReadyWriteCallback(nullptr);
+    socket->setReadyReadCallback([expire]() { expire(true); });
+    socket->setDisconnectedCallback([expire]() { expire(false); });
+
+    Private::Idle idle { std::move(socket), reactor };
+    if (d->config.idleTimeout.count())
+        idle.timer = raw->reactor()->addTimer(d->config.idleTimeout, [expire]() { expire(false); });
+
+    std::deque<Private::Idle> evicted;
+    {
+        std::lock_guard<std::mutex> lock(d->mutex);
+        auto &                      list = d->idle[key];
+        list.push_back(std::move(idle));
+        while (list.size() > d->config.maxIdlePerHost) {
+            evicted.push_back(std::move(list.front()));
+            list.pop_front();
+        }
+        if (list.empty())
+            d->idle.erase(key);
+    }
+    for (auto &old : evicted)
+        Private::close(std::move(old));
+}
+
+std::size_t ConnectionPool::idleCount() const
+{
+    std::lock_guard<std::mutex> lock(d->mutex);
+    std::size_t                 count = 0;
+    for (auto const &[key, list] : d->idle)
+        count += list.size();
+    return count;
+}
+
+std::size_t ConnectionPool::idleCount(const std::string &key) const
+{
+    std::lock_guard<std::mutex> lock(d->mutex);
+    auto                        it = d->idle.find(key);
+    return it == d->idle.end() ? 0 : it->second.size();
+}
+
+void ConnectionPool::clear()
+{
+    decltype(d->idle) idle;
+    {
+        std::lock_guard<std::mutex> lock(d->mutex);
+        idle.swap(d->idle);
+    }
+    for (auto &[key, list] : idle)
+        for (auto &entry : list)
+            Private::close(std::move(entry));
+}
+
+} // namespace TM
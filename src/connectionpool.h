@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2020 Sergey Ilinykh <rion4ik@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of mosquitto nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef CONNECTIONPOOL_H
+#define CONNECTIONPOOL_H
+
+#include <chrono>
+#include <memory>
+#include <string>
+
+namespace TM {
+
+class Reactor;
+class Socket;
+
+/**
+ * @brief ConnectionPool keeps idle keep-alive connections for reuse by later requests.
+ *
+ * Connections are grouped by a key naming their origin (e.g. scheme, host and port). A parked
+ * connection is closed once it's idle for too long, when the peer closes it or sends anything
+ * unsolicited, and when there are too many idle ones to the same origin (the oldest go first).
+ * The pool may be shared between threads. A connection is handed out only to the requests of the
+ * reactor it was parked by, and with a ReactorPool only on the thread of the loop it's bound to.
+ */
+class ConnectionPool {
+public:
+    struct Config {
+        std::size_t               maxIdlePerHost = 6;
+        std::chrono::milliseconds idleTimeout { 30000 };
+    };
+
+    ConnectionPool();
+    ConnectionPool(const Config &config);
+    ~ConnectionPool();
+    ConnectionPool(const ConnectionPool &) = delete;
+    ConnectionPool &operator=(const ConnectionPool &) = delete;
+
+    const Config &config() const;
+
+    // the most recently parked healthy connection to the origin, nullptr if there is none. the
+    // callbacks are the caller's to set
+    std::shared_ptr<Socket> take(const std::string &key, const std::shared_ptr<Reactor> &reactor);
+    // parks a connected socket with no request in flight. it's closed instead if it's unhealthy
+    void put(const std::string &key, const std::shared_ptr<Reactor> &reactor,
+             std::shared_ptr<Socket> socket);
+
+    std::size_t idleCount() const;
+    std::size_t idleCount(const std::string &key) const;
+    // closes all the idle connections
+    void clear();
+
+private:
+    // shared with the callbacks of the parked sockets, which may outlive the pool
+    struct Private;
+    std::shared_ptr<Private> d;
+};
+
+} // namespace TM
+
+#endif // CONNECTIONPOOL_H
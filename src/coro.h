@@ -0,0 +1,210 @@
+/*
+ * Copyright (c) 2020 Sergey Ilinykh <rion4ik@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of mosquitto nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef CORO_H
+#define CORO_H
+
+#include <chrono>
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+#include "log.h"
+#include "reactor.h"
+
+namespace TM {
+
+template <typename T = void> class Task;
+
+namespace detail {
+
+    struct PromiseBase {
+        std::coroutine_handle<> continuation;
+        std::exception_ptr      error;
+        bool                    detached = false;
+
+        struct FinalAwaiter {
+            bool await_ready() const noexcept { return false; }
+            template <typename P>
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept
+            {
+                auto &promise = h.promise();
+                if (promise.detached) {
+                    if (promise.error) {
+                        try {
+                            std::rethrow_exception(promise.error);
+                        } catch (std::exception &e) {
+                            Log("Unhandled exception in detached coroutine: ") << e.what();
+                        } catch (...) {
+                            Log("Unhandled exception in detached coroutine");
+                        }
+                    }
+                    h.destroy();
+                    return std::noop_coroutine();
+                }
+                return promise.continuation ? promise.continuation : std::noop_coroutine();
+            }
+            void await_resume() const noexcept { }
+        };
+
+        std::suspend_always initial_suspend() const noexcept { return {}; }
+        FinalAwaiter        final_suspend() const noexcept { return {}; }
+        void                unhandled_exception() noexcept { error = std::current_exception(); }
+    };
+
+    template <typename T> struct Promise : PromiseBase {
+        std::optional<T> value;
+
+        Task<T> get_return_object();
+        void    return_value(T v) { value.emplace(std::move(v)); }
+        T       result()
+        {
+            if (error)
+                std::rethrow_exception(error);
+            return std::move(*value);
+        }
+    };
+
+    template <> struct Promise<void> : PromiseBase {
+        Task<void> get_return_object();
+        void       return_void() { }
+        void       result()
+        {
+            if (error)
+                std::rethrow_exception(error);
+        }
+    };
+
+} // namespace detail
+
+/**
+ * @brief Task is a lazily started coroutine.
+ * It runs when awaited (and resumes the awaiter on completion by symmetric transfer) or when
+ * passed to spawn(). Exceptions are propagated to the awaiter.
+ */
+template <typename T> class Task {
+public:
+    using promise_type = detail::Promise<T>;
+    using Handle       = std::coroutine_handle<promise_type>;
+
+    Task(Task &&other) noexcept : _handle(std::exchange(other._handle, nullptr)) { }
+    Task(const Task &) = delete;
+    Task &operator=(Task &&other) noexcept
+    {
+        if (this != &other) {
+            if (_handle)
+                _handle.destroy();
+            _handle = std::exchange(other._handle, nullptr);
+        }
+        return *this;
+    }
+    ~Task()
+    {
+        if (_handle)
+            _handle.destroy();
+    }
+
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept
+    {
+        _handle.promise().continuation = awaiter;
+        return _handle;
+    }
+    T await_resume() { return _handle.promise().result(); }
+
+private:
+    friend promise_type;
+    friend void spawn(Task<void> task);
+
+    explicit Task(Handle handle) : _handle(handle) { }
+
+    Handle _handle;
+};
+
+namespace detail {
+
+    template <typename T> Task<T> Promise<T>::get_return_object()
+    {
+        return Task<T>(std::coroutine_handle<Promise<T>>::from_promise(*this));
+    }
+
+    inline Task<void> Promise<void>::get_return_object()
+    {
+        return Task<void>(std::coroutine_handle<Promise<void>>::from_promise(*this));
+    }
+
+} // namespace detail
+
+// starts the task right away and lets it free itself when done. call it on the reactor's thread.
+// exceptions escaping a spawned task are logged and dropped
+inline void spawn(Task<void> task)
+{
+    auto handle               = std::exchange(task._handle, nullptr);
+    handle.promise().detached = true;
+    handle.resume();
+}
+
+/**
+ * @brief Delay suspends the coroutine for the given time using reactor's timers.
+ * Usage: co_await TM::Delay(*reactor, 100ms);
+ */
+class Delay {
+public:
+    Delay(Reactor &reactor, std::chrono::milliseconds timeout) :
+        _reactor(reactor), _timeout(timeout)
+    {
+    }
+    Delay(const Delay &) = delete;
+    ~Delay()
+    {
+        // the coroutine was destroyed while sleeping
+        if (_timer != Reactor::InvalidTimer)
+            _reactor.cancelTimer(_timer);
+    }
+
+    bool await_ready() const noexcept { return _timeout.count() <= 0; }
+    void await_suspend(std::coroutine_handle<> handle)
+    {
+        _timer = _reactor.addTimer(_timeout, [this, handle]() {
+            _timer = Reactor::InvalidTimer;
+            handle.resume();
+        });
+    }
+    void await_resume() const noexcept { }
+
+private:
+    Reactor &                 _reactor;
+    std::chrono::milliseconds _timeout;
+    Reactor::TimerId          _timer = Reactor::InvalidTimer;
+};
+
+} // namespace TM
+
+#endif // CORO_H
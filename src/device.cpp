@@ -27,14 +27,26 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#include "bufferchain.h"
 #include "device.h"
 #include "log.h"
 #include "reactor.h"
 
 namespace TM {
 
+// buffers passed to one writev. the rest goes with the next call
+static const int MaxIov = 64;
+// small writes are appended to the last queued buffer instead of taking an iovec each
+static const std::size_t CoalesceSz = 4096;
+
 Device::Device() {}
 
 Device::~Device()
@@ -42,32 +54,360 @@ Device::~Device()
     if (fd >= 0) {
         close(fd);
     }
+    if (_pipe[0] != -1) {
+        close(_pipe[0]);
+        close(_pipe[1]);
+    }
 }
 
 void Device::setReactor(std::shared_ptr<Reactor> r) { _reactor = r; }
 
-std::size_t Device::write(const std::string &data)
+void Device::setWriteInterest(bool enabled)
+{
+    if (_writeInterest == enabled)
+        return;
+    auto before    = interest();
+    _writeInterest = enabled;
+    updateInterest(before);
+}
+
+unsigned Device::interest() const
+{
+    return (writeInterest() ? 1 : 0) | (receiveInterest() ? 2 : 0);
+}
+
+void Device::updateInterest(unsigned before)
+{
+    if (before != interest() && fd != -1 && _reactor)
+        _reactor->updateDevice(shared_from_this());
+}
+
+void Device::setWriteWatermarks(std::size_t low, std::size_t high)
+{
+    _lowWatermark  = low;
+    _highWatermark = high;
+}
+
+std::string Device::description() const { return "fd=" + std::to_string(fd); }
+
+void Device::dispatchRead(bool drain)
+{
+    // received input left unread is offered again while the handler takes some of it, as a
+    // level-triggered reactor would report the descriptor readable again
+    std::size_t unread;
+    do {
+        unread      = _received.size();
+        _moreToRead = false;
+        on_readyRead();
+    } while (fd != -1
+             && ((drain && _moreToRead) || (!_received.empty() && _received.size() < unread)));
+}
+
+void Device::dispatchWrite()
+{
+    auto before = interest();
+    flush();
+    bool notify = _writeInterest || (_writeBlocked && _outSize <= _lowWatermark);
+    if (_outSize <= _lowWatermark)
+        _writeBlocked = false;
+    updateInterest(before);
+    if (notify && fd != -1)
+        on_readyWrite();
+}
+
+std::size_t Device::write(std::string_view data)
+{
+    return write(std::span<const std::string_view>(&data, 1));
+}
+
+std::size_t Device::write(std::span<const std::string_view> buffers)
+{
+    if (fd == -1)
+        return 0;
+
+    auto        before = interest();
+    std::size_t total  = 0;
+    std::size_t sent   = 0;
+    for (auto const &buf : buffers)
+        total += buf.size();
+    // the queued output has to go first. it's flushed as soon as the descriptor is writable
+    if (!_outSize && (sent = send(buffers)) == std::size_t(-1)) {
+        _atEnd = true;
+        return 0;
+    }
+
+    auto skip = sent;
+    for (auto const &buf : buffers) {
+        if (skip >= buf.size()) {
+            skip -= buf.size();
+            continue;
+        }
+        auto tail = buf.substr(skip);
+        skip      = 0;
+        if (!_outQueue.empty() && _outQueue.back().size() + tail.size() <= CoalesceSz)
+            _outQueue.back().append(tail);
+        else
+            _outQueue.emplace_back(tail);
+        _outSize += tail.size();
+    }
+    if (writeBufferFull())
+        _writeBlocked = true;
+    updateInterest(before);
+    return total;
+}
+
+std::size_t Device::send(std::span<const std::string_view> buffers)
 {
-    return writeData(data.c_str(), data.length());
+    std::size_t sent = 0;
+    while (!buffers.empty()) {
+        iovec       iov[MaxIov];
+        int         count = 0;
+        std::size_t size  = 0;
+        for (; count < MaxIov && std::size_t(count) < buffers.size(); count++) {
+            iov[count].iov_base = const_cast<char *>(buffers[count].data());
+            iov[count].iov_len  = buffers[count].size();
+            size += buffers[count].size();
+        }
+        auto len = writeData(iov, count);
+        if (len == std::size_t(-1))
+            return len;
+        sent += len;
+        if (len < size)
+            break; // the descriptor is full
+        buffers = buffers.subspan(std::size_t(count));
+    }
+    return sent;
 }
+
+void Device::flush()
+{
+    if (_transportBacklog && !flushTransport()) {
+        _atEnd = true;
+        discardOutput();
+        return;
+    }
+    while (_outSize) {
+        std::string_view views[MaxIov];
+        std::size_t      count = 0;
+        std::size_t      size  = 0;
+        for (auto it = _outQueue.begin(); it != _outQueue.end() && count < MaxIov; ++it) {
+            views[count] = count ? std::string_view(*it) : std::string_view(*it).substr(_outOffset);
+            size += views[count++].size();
+        }
+        auto sent = send(std::span<const std::string_view>(views, count));
+        if (sent == std::size_t(-1)) {
+            _atEnd = true;
+            discardOutput();
+            return;
+        }
+
+        _outSize -= sent;
+        auto len = sent + _outOffset;
+        while (!_outQueue.empty() && len >= _outQueue.front().size()) {
+            len -= _outQueue.front().size();
+            _outQueue.pop_front();
+        }
+        _outOffset = len;
+        if (sent < size)
+            return;
+    }
+}
+
+void Device::discardOutput()
+{
+    auto before = interest();
+    _outQueue.clear();
+    _outOffset        = 0;
+    _outSize          = 0;
+    _writeBlocked     = false;
+    _transportBacklog = false;
+    updateInterest(before);
+}
+
+void Device::setTransportBacklog(bool pending)
+{
+    auto before       = interest();
+    _transportBacklog = pending;
+    updateInterest(before);
+}
+
 std::vector<std::byte> Device::read(std::size_t size) { return readData(size); }
 
-std::vector<std::byte> Device::readData(std::size_t size)
+std::size_t Device::read(std::span<std::byte> buffer)
 {
-    std::vector<std::byte> buf(size > ReadBufSz ? ReadBufSz : size);
-    // FIXME figure out how many bytes available before allocating buffer
-    auto realsize = ::read(fd, buf.data(), buf.size());
+    return readInto(buffer.data(), buffer.size());
+}
+
+std::size_t Device::read(BufferChain &chain, std::size_t size)
+{
+    // nothing pending still needs a read to notice the end of stream
+    auto available = bytesAvailable();
+    if (!available)
+        available = ReadBufSz;
+    if (!size || size > available)
+        size = available;
+
+    auto space = chain.prepare(size);
+    auto len   = readInto(reinterpret_cast<std::byte *>(space.data()), size);
+    chain.commit(len);
+    return len;
+}
+
+std::size_t Device::readTo(int out, std::size_t size)
+{
+    if (_pipe[0] == -1 && pipe2(_pipe, O_NONBLOCK | O_CLOEXEC) == -1) {
+        Log::syserr("failed to create pipe");
+        return std::size_t(-1);
+    }
+    // the pipe is emptied before returning, so its whole capacity is available
+    size = size ? std::min(size, PipeSz) : PipeSz;
+    if (!_received.empty() || _receivedEnd || receiveInterest()) {
+        // the reactor reads the descriptor, what it got is copied
+        std::byte buf[BufferChain::BlockSz];
+        auto      len = takeReceived(buf, std::min(size, sizeof(buf)));
+        for (std::size_t written = 0; written < len;) {
+            auto n = ::write(out, buf + written, len - written);
+            if (n <= 0) {
+                Log::syserr("failed to write output");
+                return std::size_t(-1);
+            }
+            written += std::size_t(n);
+        }
+        return len;
+    }
+
+    auto len = splice(fd, nullptr, _pipe[1], nullptr, size, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (len < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            Log::syserr("splice failed");
+            _atEnd = true;
+        }
+        return 0;
+    }
+    _moreToRead = len && std::size_t(len) == size;
+    _atEnd      = !len;
+
+    for (ssize_t moved = 0; moved < len;) {
+        auto n = splice(_pipe[0], nullptr, out, nullptr, std::size_t(len - moved), SPLICE_F_MOVE);
+        if (n <= 0) {
+            Log::syserr("splice to output failed");
+            return std::size_t(-1);
+        }
+        moved += n;
+    }
+    return std::size_t(len);
+}
+
+std::size_t Device::bytesAvailable() const
+{
+    int available = 0;
+    if (fd == -1 || ioctl(fd, FIONREAD, &available) < 0)
+        return _received.size();
+    return _received.size() + std::size_t(available);
+}
+
+void Device::setReceiving(bool enabled)
+{
+    auto before = interest();
+    _receiving  = enabled;
+    updateInterest(before);
+}
+
+void Device::setReceivable(bool receivable)
+{
+    auto before = interest();
+    _receivable = receivable;
+    updateInterest(before);
+}
+
+bool Device::receiveInterest() const
+{
+    return _receiving && _receivable && !_receivedEnd && _received.size() < ReceiveHighWatermark;
+}
+
+void Device::receive(std::span<const std::byte> data)
+{
+    auto before = interest();
+    if (data.empty()) {
+        _receivedEnd = true;
+    } else {
+        auto space = _received.prepare(data.size());
+        memcpy(space.data(), data.data(), data.size());
+        _received.commit(data.size());
+    }
+    updateInterest(before);
+}
+
+void Device::discardInput()
+{
+    auto before = interest();
+    _received.clear();
+    _receivedEnd = false;
+    updateInterest(before);
+}
+
+std::size_t Device::takeReceived(std::byte *data, std::size_t size)
+{
+    auto before = interest();
+    auto len    = std::min(size, _received.size());
+    for (std::size_t copied = 0; copied < len;) {
+        auto view = _received.slices().front().view();
+        auto n    = std::min(view.size(), len - copied);
+        memcpy(data + copied, view.data(), n);
+        _received.consume(n);
+        copied += n;
+    }
+    _moreToRead = len && len == size;
+    _atEnd      = !len && size && _receivedEnd;
+    updateInterest(before);
+    return len;
+}
+
+std::size_t Device::readInto(std::byte *data, std::size_t size)
+{
+    // while the reactor reads the descriptor it's not touched here, the bytes would go out of
+    // order otherwise. the end of stream comes after all the received input too
+    if (!_received.empty() || _receivedEnd || receiveInterest())
+        return takeReceived(data, size);
+
+    auto realsize = ::read(fd, data, size);
     if (realsize < 0) {
-        Log::syserr("read failed");
-        return std::vector<std::byte>();
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            Log::syserr("read failed");
+            _atEnd = true; // e.g. connection reset
+        }
+        return 0;
     }
-    buf.resize(std::size_t(realsize));
+    // a short read means the socket buffer was exhausted
+    _moreToRead = realsize && std::size_t(realsize) == size;
+    _atEnd      = !realsize && size;
+    return std::size_t(realsize);
+}
+
+std::vector<std::byte> Device::readData(std::size_t size)
+{
+    // nothing pending still needs a read to notice the end of stream
+    auto available = bytesAvailable();
+    if (!available)
+        available = ReadBufSz;
+    if (!size || size > available)
+        size = available;
+
+    std::vector<std::byte> buf(size);
+    buf.resize(readInto(buf.data(), buf.size()));
     return buf;
 }
 
-std::size_t Device::writeData(const char *data, std::size_t size)
+std::size_t Device::writeData(const iovec *iov, int count)
 {
-    return std::size_t(::write(fd, data, size));
+    auto len = ::writev(fd, iov, count);
+    if (len < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            return 0;
+        Log::syserr("write failed");
+        return std::size_t(-1);
+    }
+    return std::size_t(len);
 }
 
 } // namespace TM
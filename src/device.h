@@ -31,35 +31,141 @@
 #define DEVICE_H
 
 #include <cstddef>
+#include <deque>
 #include <memory>
+#include <span>
+#include <string>
+#include <string_view>
 #include <vector>
 
+#include "bufferchain.h"
+
+struct iovec;
+
 namespace TM {
 
 class Reactor;
 
 class Device : public std::enable_shared_from_this<Device> {
 public:
-    static const int ReadBufSz = 4096;
+    static const int         ReadBufSz          = 4096;
+    static const std::size_t WriteHighWatermark = 256 * 1024;
+    static const std::size_t WriteLowWatermark  = 64 * 1024;
 
     Device();
     virtual ~Device();
 
-    void                   setReactor(std::shared_ptr<Reactor>);
-    int                    fileDescriptor() const { return fd; }
-    std::vector<std::byte> read(std::size_t size);
-    std::size_t            write(const std::string &data);
+    void                     setReactor(std::shared_ptr<Reactor>);
+    std::shared_ptr<Reactor> reactor() const { return _reactor; }
+    int                      fileDescriptor() const { return fd; }
+    std::vector<std::byte>   read(std::size_t size);
+    std::size_t              read(std::span<std::byte> buffer);
+    // appends up to size bytes (0 - whatever is available) to the chain's tail block
+    std::size_t read(BufferChain &chain, std::size_t size = 0);
+    // moves up to size bytes (0 - as much as fits a pipe) to another descriptor, e.g. a file,
+    // without copying them to user space. returns 0 if nothing was read (see atEnd()) and
+    // size_t(-1) if writing to fd failed. fd is expected to be blocking
+    virtual std::size_t readTo(int fd, std::size_t size = 0);
+
+    // sends as much as the descriptor takes right away and queues the rest, which is flushed
+    // when it gets writable. nothing is lost on partial writes. returns the number of bytes
+    // accepted, i.e. everything unless the device is closed or failed
+    std::size_t write(std::string_view data);
+    // gathers the buffers into as few syscalls as possible (e.g. pipelined requests)
+    std::size_t write(std::span<const std::string_view> buffers);
+
+    // accepted by write() but not sent yet
+    std::size_t bytesToWrite() const { return _outSize; }
+
+    // producers should stop writing once writeBufferFull() and wait for on_readyWrite, which
+    // is called when the queue drains to the low watermark
+    void setWriteWatermarks(std::size_t low, std::size_t high);
+    bool writeBufferFull() const { return _outSize >= _highWatermark; }
+
+    // on_readyWrite is called only while write interest is enabled. the reactor also watches
+    // writability while there is queued output
+    bool writeInterest() const { return _writeInterest || _outSize || _transportBacklog; }
+    void setWriteInterest(bool enabled);
+
+    // calls on_readyRead. with drain=true (edge-triggered reactors) repeats it while the last
+    // read filled the buffer completely, i.e. the input wasn't exhausted yet.
+    void dispatchRead(bool drain);
+
+    // flushes queued output and calls on_readyWrite if it's wanted (see writeInterest and
+    // writeBufferFull)
+    void dispatchWrite();
+
+    // bytes which can be read right now without blocking (may underestimate, e.g. with TLS)
+    virtual std::size_t bytesAvailable() const;
+
+    // set by the reactor if it can read the input on the device's behalf (io_uring recv).
+    // while receiveInterest() it does, and the device reads only what was passed to receive()
+    void setReceiving(bool enabled);
+    bool receiveInterest() const;
+    // input read by the reactor. empty data is the end of stream
+    void receive(std::span<const std::byte> data);
+
+    // the peer closed its side or the connection failed. set by read
+    bool atEnd() const { return _atEnd; }
+
+    // human readable identification for logs and statistics
+    virtual std::string description() const;
 
     virtual void on_readyRead()  = 0;
     virtual void on_readyWrite() = 0;
 
 protected:
+    // reads up to size bytes into data. returns 0 if nothing was read, see atEnd() for the reason
+    virtual std::size_t            readInto(std::byte *data, std::size_t size);
     virtual std::vector<std::byte> readData(std::size_t size = 0);
-    virtual std::size_t            writeData(const char *data, std::size_t size);
+    // writes the buffers in order. returns how many bytes were taken, 0 if the descriptor is
+    // full and size_t(-1) on error
+    virtual std::size_t            writeData(const iovec *iov, int count);
+
+    // drops queued output, e.g. on disconnect
+    void discardOutput();
+    // drops input received by the reactor and not read yet
+    void discardInput();
+    // whether the reactor may read the input. off for descriptors it can't recv() from or
+    // when somebody else reads them (e.g. openssl with kTLS)
+    void setReceivable(bool receivable);
+
+    // output buffered below the queue, e.g. records encrypted by SecureSocket but not sent
+    // yet. while there is some, writability is watched and flushTransport() is called before
+    // the queue is flushed. returns false on error
+    void         setTransportBacklog(bool pending);
+    virtual bool flushTransport() { return true; }
 
 protected:
     int                      fd = -1;
     std::shared_ptr<Reactor> _reactor;
+    bool                     _writeInterest = false;
+    bool                     _moreToRead    = false; // set by readInto
+    bool                     _atEnd         = false; // set by readInto
+
+private:
+    static constexpr std::size_t PipeSz = 65536; // default capacity of a pipe
+    // unread received input at which the reactor stops reading and only watches readability
+    static constexpr std::size_t ReceiveHighWatermark = 256 * 1024;
+
+    void        flush();
+    std::size_t send(std::span<const std::string_view> buffers);
+    std::size_t takeReceived(std::byte *data, std::size_t size);
+    unsigned    interest() const;
+    void        updateInterest(unsigned before);
+
+    std::deque<std::string> _outQueue;
+    std::size_t             _outOffset        = 0; // already sent from the front of _outQueue
+    std::size_t             _outSize          = 0; // total bytes in _outQueue minus _outOffset
+    std::size_t             _lowWatermark     = WriteLowWatermark;
+    std::size_t             _highWatermark    = WriteHighWatermark;
+    bool                    _writeBlocked     = false; // reached the high watermark
+    bool                    _transportBacklog = false; // see setTransportBacklog
+    int                     _pipe[2]          = { -1, -1 }; // for readTo, created on demand
+    BufferChain             _received;                 // input read by the reactor
+    bool                    _receivedEnd      = false; // and the end of stream after it
+    bool                    _receivable       = false; // see setReceivable
+    bool                    _receiving        = false; // see setReceiving
 };
 
 } // namespace TM
@@ -39,6 +39,11 @@ public:
     using std::runtime_error::runtime_error;
 };
 
+class TlsException : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
 class NoValidBrief : public std::runtime_error {
 public:
     using std::runtime_error::runtime_error;
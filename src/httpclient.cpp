@@ -29,34 +29,131 @@
 
 #include <cstring>
 #include <map>
+#include <unistd.h>
 
+#include "connectionpool.h"
 #include "httpclient.h"
 #include "log.h"
+#include "reactor.h"
 #include "securesocket.h"
 #include "strutil.h"
+#include "tlscontext.h"
 #include "url.h"
 
 namespace TM {
 
+static constexpr std::uint8_t MaxRedirects = 5;
+static constexpr std::size_t  MaxChunkLine = 4096; // chunk size with extensions, or a trailer
+
 struct HttpClient::Private {
+    // how the end of the body is recognized
+    enum Framing : std::uint8_t { UntilClose, Length, Chunked };
+    enum ChunkState : std::uint8_t { ChunkSize, ChunkData, ChunkEnd, Trailers, ChunksDone };
+
     std::shared_ptr<Reactor>            reactor;
     Url                                 url;
-    std::function<void(std::string &&)> callback;
+    std::function<void(BufferChain &&)> callback;
     std::shared_ptr<Socket>             socket;
-    std::string                         contents;
+    BufferChain                         contents;
+    std::size_t                         headersScanned = 0; // no header end before this offset
     bool                                headersParsed  = false;
-    uint8_t                             redirectsAvail = 5;
+    uint8_t                             redirectsAvail = MaxRedirects;
     int                                 status;
     size_t                              bytesToRead = 0;
+    Framing                             framing     = UntilClose;
+    ChunkState                          chunkState  = ChunkSize;
+    std::size_t                         chunkLeft   = 0; // of the current chunk's data
+    BufferChain                         body;            // decoded chunks
     std::map<std::string, std::string>  headers;
+    std::chrono::milliseconds           timeout { 0 };
+    SocketOptions                       socketOptions;
+    Socket::Connector                   connector;
+    std::shared_ptr<TlsContext>         tlsContext;
+    std::shared_ptr<ConnectionPool>     pool;
+    std::shared_ptr<Reactor>            timerReactor;
+    Reactor::TimerId                    deadlineTimer = Reactor::InvalidTimer;
+    bool                                finished      = false;
+    bool                                completed     = false;
+    bool                                earlyData     = false;
+    bool                                persistent    = false; // the server keeps the connection
+    bool                                reused        = false; // the connection came from the pool
+    int                                 output        = -1; // archive mode
+    std::size_t                         written       = 0;  // body bytes written to output
+
+    void finish(BufferChain &&body, bool complete = false)
+    {
+        finished  = true;
+        completed = complete;
+        stopDeadline();
+        callback(std::move(body));
+    }
+
+    // archive mode. whatever came along with the headers is written out, the rest of the body
+    // goes from the socket to the output directly. chunked bodies are written as decoded
+    bool writeOutput(BufferChain &data)
+    {
+        for (auto const &slice : data.slices()) {
+            auto data = slice.view();
+            while (!data.empty()) {
+                auto n = ::write(output, data.data(), data.size());
+                if (n <= 0) {
+                    Log::syserr("Failed to write the body");
+                    return false;
+                }
+                data.remove_prefix(std::size_t(n));
+                written += std::size_t(n);
+            }
+        }
+        data.clear();
+        return true;
+    }
+
+    void archive()
+    {
+        bool knownSize = framing == Length;
+        auto len       = socket->readTo(output, knownSize ? bytesToRead - written : 0);
+        if (len == std::size_t(-1)) {
+            socket->disconnect();
+            finish({});
+            return;
+        }
+        written += len;
+        if (knownSize && written >= bytesToRead) {
+            releaseSocket();
+            finish({}, true);
+        }
+    }
+
+    void startDeadline()
+    {
+        // socket's reactor is preferred since in a pool it's the thread of all the callbacks
+        timerReactor  = socket && socket->reactor() ? socket->reactor() : reactor;
+        deadlineTimer = timerReactor->addTimer(timeout, [this]() {
+            deadlineTimer = Reactor::InvalidTimer;
+            Log("Request timed out: ") << std::string(url);
+            socket->disconnect();
+            finish({});
+        });
+    }
+
+    void stopDeadline()
+    {
+        if (deadlineTimer != Reactor::InvalidTimer) {
+            timerReactor->cancelTimer(deadlineTimer);
+            deadlineTimer = Reactor::InvalidTimer;
+        }
+    }
 
     void tryParseHeaders()
     {
-        auto idx = contents.find("\r\n\r\n");
-        if (idx == std::string::npos)
+        auto idx = contents.find("\r\n\r\n", headersScanned);
+        if (idx == BufferChain::npos) {
+            headersScanned = contents.size() > 3 ? contents.size() - 3 : 0;
             return;
-        auto rawHeaders = contents.substr(0, idx + 2);
-        contents        = contents.substr(idx + 4);
+        }
+        // the body stays where it was read, only the headers are copied out for parsing
+        auto rawHeaders = contents.split(idx + 4).toString();
+        rawHeaders.resize(idx + 2);
 
         Log("=== Response headers ===\n") << rawHeaders;
 
@@ -67,7 +164,8 @@ struct HttpClient::Private {
         idx = line.find(' ');
         if (idx == std::string::npos)
             throw std::invalid_argument(line);
-        auto idx2 = line.find(' ', idx + 1);
+        auto version = line.substr(0, idx);
+        auto idx2    = line.find(' ', idx + 1);
         if (idx2 == std::string::npos)
             throw std::invalid_argument(line);
         status = std::atoi(&line[idx + 1]);
@@ -91,98 +189,281 @@ struct HttpClient::Private {
             else
                 it->second += value;
         }
+        // transfer-encoding overrides content-length
+        auto encoding = headers.count("transfer-encoding") ? headers["transfer-encoding"]
+                                                           : std::string();
+        str::tolower(encoding);
         auto clit = headers.find("content-length");
-        if (clit != headers.end()) {
+        if (encoding.find("chunked") != std::string::npos) {
+            framing = Chunked;
+        } else if (clit != headers.end()) {
+            framing     = Length;
             bytesToRead = std::strtoul(clit->second.c_str(), nullptr, 10);
+            // the rest of the body is read right after the part which came with the headers
+            if (output == -1)
+                contents.reserve(bytesToRead);
+        } else if (status < 200 || status == 204 || status == 304) {
+            framing = Length; // never has a body
+        } else {
+            framing = UntilClose;
         }
+        auto connection = headers.count("connection") ? headers["connection"] : std::string();
+        str::tolower(connection);
+        if (version == "HTTP/1.1")
+            persistent = connection.find("close") == std::string::npos;
+        else
+            persistent = connection.find("keep-alive") != std::string::npos;
 
         headersParsed = true;
     }
 
-    void doRequest()
+    std::string request() const
     {
-        socket = url.scheme() == Url::Https ? std::make_shared<SecureSocket>()
-                                            : std::make_shared<Socket>();
-        socket->setReactor(reactor);
+        std::ostringstream query;
+        query << "GET " << (url.uri().empty() ? "/" : url.uri())
+              << " HTTP/1.1\r\n"
+                 "Host: "
+              << (url.host().find(':') == std::string::npos ? url.host() : "[" + url.host() + "]")
+              << "\r\n"
+                 "Accept: text/*\r\n"
+                 "User-Agent: Mozilla/5.0 (X11; Ubuntu; Linux x86_64; rv:72.0) Gecko/20100101 "
+                 "Firefox/72.0\r\n"
+              << (pool ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n");
+        return query.str();
+    }
 
-        socket->setConnectedCallback([this]() {
-            std::ostringstream query;
-            query << "GET " << (url.uri().empty() ? "/" : url.uri())
-                  << " HTTP/1.1\r\n"
-                     "Host: "
-                  << url.host()
-                  << "\r\n"
-                     "Accept: text/*\r\n"
-                     "User-Agent: Mozilla/5.0 (X11; Ubuntu; Linux x86_64; rv:72.0) Gecko/20100101 "
-                     "Firefox/72.0\r\n"
-                     "Connection: close\r\n\r\n";
-            Log("=== Request ===\n") << query.str();
-            socket->write(query.str());
-        });
+    // connections made with other tls settings (e.g. without peer verification) aren't shared
+    std::string poolKey() const
+    {
+        if (url.scheme() != Url::Https)
+            return "http://" + url.host() + ":" + std::to_string(url.port());
+        auto context = tlsContext ? tlsContext : TlsContext::defaultContext();
+        return "https://" + url.host() + ":" + std::to_string(url.port()) + "/"
+            + std::to_string(reinterpret_cast<std::uintptr_t>(context.get()));
+    }
 
-        socket->setReadyReadCallback([this]() {
-            // we really have to parse response headers instead of size hardcoding. but no time for
-            // this
-            size_t toRead = headersParsed && bytesToRead ? bytesToRead - contents.size() : 16384;
-            if (toRead > 16384)
-                toRead = 16384;
-
-            auto bytes = socket->read(toRead);
-            if (bytes.size()) {
-                std::string partContents(reinterpret_cast<const char *>(&bytes[0]), bytes.size());
-                contents += std::move(partContents);
-                if (!headersParsed) {
-                    try {
-                        tryParseHeaders();
-                    } catch (std::invalid_argument &e) {
-                        socket->disconnect();
-                        Log("Failed to parse headers: ") << e.what();
-                        callback("");
-                        return;
-                    }
-
-                    // if we just parsed headers. let's check for reirections
-                    if (headersParsed) {
-                        if (handleRedirect())
-                            return;
-                    }
-                }
-                Log("content-size=") << contents.size() << " of " << bytesToRead;
-                if (headersParsed && contents.size() == bytesToRead) {
-                    std::string body;
-                    std::swap(body, contents);
-                    socket->disconnect();
-                    callback(std::move(body));
-                }
+    // moves the data of complete chunks from contents to body. false if the framing is broken
+    bool decodeChunks()
+    {
+        while (chunkState != ChunksDone) {
+            if (chunkState == ChunkData) {
+                if (contents.empty())
+                    return true;
+                auto n = std::min(chunkLeft, contents.size());
+                body.append(contents.split(n));
+                chunkLeft -= n;
+                if (!chunkLeft)
+                    chunkState = ChunkEnd;
+                continue;
             }
-        });
+            auto eol = contents.find("\r\n");
+            if (eol == BufferChain::npos)
+                return contents.size() < MaxChunkLine;
+            auto line = contents.split(eol + 2).toString();
+            line.resize(eol);
+            switch (chunkState) {
+            case ChunkSize: {
+                // chunk extensions after ';' are ignored
+                char *end;
+                chunkLeft = std::strtoul(line.c_str(), &end, 16);
+                if (end == line.c_str())
+                    return false;
+                chunkState = chunkLeft ? ChunkData : Trailers;
+                break;
+            }
+            case ChunkEnd:
+                if (!line.empty())
+                    return false;
+                chunkState = ChunkSize;
+                break;
+            default:
+                // trailers are skipped till the empty line
+                if (line.empty())
+                    chunkState = ChunksDone;
+            }
+        }
+        return true;
+    }
 
-        socket->setDisconnectedCallback([this]() { callback(""); });
+    bool bodyComplete() const
+    {
+        if (framing == Chunked)
+            return chunkState == ChunksDone;
+        return framing == Length && contents.size() + written >= bytesToRead;
+    }
+
+    // back to the pool if the whole response was read and the server keeps the connection
+    void releaseSocket()
+    {
+        auto sock     = std::move(socket);
+        bool reusable = framing == Chunked
+            ? chunkState == ChunksDone && contents.empty()
+            : framing == Length && contents.size() + written == bytesToRead;
+        if (pool && persistent && reusable)
+            pool->put(poolKey(), reactor, std::move(sock));
+        else
+            sock->disconnect();
+    }
+
+    void resetResponse()
+    {
+        headersParsed  = false;
+        headersScanned = 0;
+        written        = 0;
+        contents.clear();
+        bytesToRead = 0;
+        framing     = UntilClose;
+        chunkState  = ChunkSize;
+        chunkLeft   = 0;
+        body.clear();
+    }
 
+    void doRequest(bool pooled = true)
+    {
+        reused = false;
+        if (pool && pooled && (socket = pool->take(poolKey(), reactor))) {
+            // established already. the tcp and tls setup are skipped
+            reused = true;
+            setCallbacks(nullptr);
+            auto query = request();
+            Log("=== Request (reused connection) ===\n") << query;
+            socket->write(query);
+            return;
+        }
+
+        std::shared_ptr<SecureSocket> secure;
+        if (url.scheme() == Url::Https) {
+            secure = std::make_shared<SecureSocket>();
+            secure->setTlsContext(tlsContext);
+            // a GET is idempotent, so it's fine to have it replayed
+            if (earlyData)
+                secure->setEarlyData(request());
+            socket = secure;
+        } else {
+            socket = std::make_shared<Socket>();
+        }
+        socket->setReactor(reactor);
+        socket->setOptions(socketOptions);
+        socket->setConnector(connector);
+        setCallbacks(secure.get());
         socket->connect(url.host(), url.port());
     }
 
+    // the handlers are members, so the socket may drop the callbacks while they run (e.g. when
+    // it goes to the pool)
+    void setCallbacks(SecureSocket *secure)
+    {
+        socket->setConnectedCallback([this, secure]() { onConnected(secure); });
+        socket->setReadyReadCallback([this]() { onReadyRead(); });
+        socket->setReadyWriteCallback(nullptr);
+        socket->setDisconnectedCallback([this]() { onDisconnected(); });
+    }
+
+    void onConnected(SecureSocket *secure)
+    {
+        if (secure && secure->earlyDataAccepted()) {
+            Log("=== Request went as early data ===");
+            return;
+        }
+        auto query = request();
+        Log("=== Request ===\n") << query;
+        socket->write(query);
+    }
+
+    void onReadyRead()
+    {
+        if (headersParsed && output != -1 && framing != Chunked) {
+            archive();
+            return;
+        }
+
+        // whatever is available unless the body size is known
+        size_t toRead = headersParsed && framing == Length && bytesToRead
+            ? bytesToRead - contents.size()
+            : 0;
+
+        // read straight into the tail block of contents, no intermediate buffers
+        if (!socket->read(contents, toRead))
+            return;
+        if (!headersParsed) {
+            try {
+                tryParseHeaders();
+            } catch (std::invalid_argument &e) {
+                socket->disconnect();
+                Log("Failed to parse headers: ") << e.what();
+                finish({});
+                return;
+            }
+            if (!headersParsed)
+                return;
+            // if we just parsed headers. let's check for reirections
+            if (handleRedirect())
+                return;
+        }
+
+        if (framing == Chunked && !decodeChunks()) {
+            socket->disconnect();
+            Log("Malformed chunked body");
+            finish({});
+            return;
+        }
+        auto &data = framing == Chunked ? body : contents;
+        if (output != -1) {
+            if (!writeOutput(data)) {
+                socket->disconnect();
+                finish({});
+            } else if (bodyComplete()) {
+                releaseSocket();
+                finish({}, true);
+            }
+            return;
+        }
+        Log("content-size=") << data.size() << " of " << bytesToRead;
+        if (bodyComplete()) {
+            releaseSocket();
+            finish(std::move(data), true);
+        }
+    }
+
+    void onDisconnected()
+    {
+        // the server may close a pooled connection right when the request is sent. nothing came
+        // back, so the request is repeated over a new connection
+        if (reused && !headersParsed && contents.empty()) {
+            Log("Reused connection was closed, retrying: ") << std::string(url);
+            doRequest(false);
+            return;
+        }
+        // without content-length or chunks the body ends with the connection
+        if (headersParsed && framing == UntilClose)
+            finish(std::move(contents), true);
+        else
+            finish({});
+    }
+
     bool handleRedirect()
     {
         if (--redirectsAvail == 0) {
             Log("Too many redirects");
-            callback("");
+            finish({});
             return false;
         }
         decltype(headers.begin()) it;
         if (status >= 300 && status < 400 && (it = headers.find("location")) != headers.end()) {
             Log("=== Handle redirect ===");
             try {
-                url = it->second;
-                socket->disconnect();
-                headersParsed = false;
-                contents.clear();
-                bytesToRead = 0;
+                Url target = it->second;
+                // the body of the redirect is likely complete, so the connection may be reused
+                if (framing == Chunked)
+                    decodeChunks();
+                releaseSocket();
+                url = target;
+                resetResponse();
                 doRequest();
                 return true;
             } catch (std::exception &e) {
                 Log("Redirect failed early: ") << e.what();
-                callback("");
+                finish({});
             }
         }
         return false;
@@ -194,12 +475,67 @@ HttpClient::HttpClient(std::shared_ptr<Reactor> reactor, const std::string &url)
 {
 }
 
-HttpClient::~HttpClient() {}
+HttpClient::~HttpClient() { d->stopDeadline(); }
+
+void HttpClient::setTimeout(std::chrono::milliseconds timeout) { d->timeout = timeout; }
 
 void HttpClient::execute(std::function<void(std::string &&)> finishCallback)
 {
-    d->callback = finishCallback;
+    execute([finishCallback = std::move(finishCallback)](BufferChain &&body) {
+        finishCallback(body.toString());
+    });
+}
+
+void HttpClient::execute(std::function<void(BufferChain &&)> finishCallback)
+{
+    d->callback  = std::move(finishCallback);
+    d->finished  = false;
+    d->completed = false;
+    // the client may be executed again, e.g. over the connection pooled by the last request
+    d->redirectsAvail = MaxRedirects;
+    d->resetResponse();
     d->doRequest();
+    if (!d->finished && d->timeout.count())
+        d->startDeadline();
+}
+
+void HttpClient::setTlsContext(std::shared_ptr<TlsContext> context)
+{
+    d->tlsContext = std::move(context);
+}
+
+void HttpClient::setEarlyData(bool enabled) { d->earlyData = enabled; }
+
+void HttpClient::setConnectionPool(std::shared_ptr<ConnectionPool> pool)
+{
+    d->pool = std::move(pool);
+}
+
+void HttpClient::setOutput(int fd) { d->output = fd; }
+
+bool HttpClient::completed() const { return d->completed; }
+
+std::size_t HttpClient::bodyWritten() const { return d->written; }
+
+void HttpClient::setSocketOptions(const SocketOptions &options) { d->socketOptions = options; }
+
+void HttpClient::setConnector(Socket::Connector connector) { d->connector = std::move(connector); }
+
+HttpClient::ExecuteAwaiter HttpClient::asyncExecute() { return ExecuteAwaiter(*this); }
+
+bool HttpClient::ExecuteAwaiter::await_suspend(std::coroutine_handle<> handle)
+{
+    // the callback captures only the awaiter, so it fits std::function's inline storage
+    _client.execute([this](std::string &&body) {
+        _body = std::move(body);
+        _done = true;
+        if (_handle)
+            _handle.resume();
+    });
+    if (_done)
+        return false; // finished synchronously, e.g. dns failure
+    _handle = handle;
+    return true;
 }
 
 } // namespace TM
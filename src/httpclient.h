@@ -30,25 +30,90 @@
 #ifndef HTTPCLIENT_H
 #define HTTPCLIENT_H
 
+#include <chrono>
+#include <coroutine>
 #include <functional>
 #include <memory>
+#include <string>
+
+#include "bufferchain.h"
+#include "socket.h"
 
 namespace TM {
 
+class ConnectionPool;
 class Reactor;
+class TlsContext;
 
 class HttpClient {
 public:
     HttpClient(std::shared_ptr<Reactor> reactor, const std::string &url);
     ~HttpClient();
 
+    // the whole request including redirects has to finish within the timeout. zero disables it
+    void setTimeout(std::chrono::milliseconds timeout);
+
+    // tcp tuning of the connections, including the ones of redirects
+    void setSocketOptions(const SocketOptions &options);
+
+    // connections, including the ones of redirects, are made by the connector (see
+    // Socket::setConnector)
+    void setConnector(Socket::Connector connector);
+
+    // tls configuration and session cache of https connections. the default context if unset
+    void setTlsContext(std::shared_ptr<TlsContext> context);
+
+    // send the request as tls 1.3 early data (0-rtt) when a session is resumed, so it doesn't
+    // wait for the handshake. early data can be replayed by an attacker, which is harmless for
+    // a GET. if the server rejects it, the request is sent again after the handshake
+    void setEarlyData(bool enabled);
+
+    // keep-alive connections are taken from the pool and returned to it once the response is
+    // read completely, so back-to-back requests to the same origin skip the tcp and tls setup.
+    // without a pool every request (and redirect) has a connection of its own
+    void setConnectionPool(std::shared_ptr<ConnectionPool> pool);
+
+    // archive mode. the body is written to fd (e.g. an opened file) instead of being collected
+    // and the finish callback gets it empty. plain http bodies are spliced from the socket
+    // without being copied to user space, https ones are written in large chunks
+    void setOutput(int fd);
+
+    // the last execute() got the whole response. in archive mode bodyWritten() bytes of it
+    // went to the output
+    bool        completed() const;
+    std::size_t bodyWritten() const;
+
+    // has to be called on the reactor's thread (or before it's started).
+    // other threads submit requests with Reactor::post
     void execute(std::function<void(std::string &&)> finishCallback);
+    // same but the body is handed over in the buffers it was read into, without copying
+    void execute(std::function<void(BufferChain &&)> finishCallback);
+
+    class ExecuteAwaiter;
+    // coroutine flavor of execute(): std::string body = co_await client.asyncExecute();
+    ExecuteAwaiter asyncExecute();
 
 private:
     struct Private;
     std::unique_ptr<Private> d;
 };
 
+class HttpClient::ExecuteAwaiter {
+public:
+    explicit ExecuteAwaiter(HttpClient &client) : _client(client) { }
+    ExecuteAwaiter(const ExecuteAwaiter &) = delete;
+
+    bool        await_ready() const noexcept { return false; }
+    bool        await_suspend(std::coroutine_handle<> handle);
+    std::string await_resume() { return std::move(_body); }
+
+private:
+    HttpClient &            _client;
+    std::string             _body;
+    std::coroutine_handle<> _handle;
+    bool                    _done = false;
+};
+
 } // namespace TM
 
 #endif // HTTPCLIENT_H
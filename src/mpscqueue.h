@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2020 Sergey Ilinykh <rion4ik@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of mosquitto nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef MPSCQUEUE_H
+#define MPSCQUEUE_H
+
+#include <atomic>
+#include <utility>
+
+namespace TM {
+
+/**
+ * @brief MpscQueue is an unbounded lock-free multi-producer single-consumer queue.
+ *
+ * It's the intrusive queue by Dmitry Vyukov. push() is wait-free and can be called from any
+ * thread, pop() has to be called from one consumer thread only. pop() may spuriously fail
+ * while a producer is in the middle of push(). Such producer is guaranteed to finish soon, so
+ * the consumer has to be woken up after every push anyway.
+ */
+template <typename T> class MpscQueue {
+public:
+    MpscQueue() : _head(&_stub), _tail(&_stub) { }
+    ~MpscQueue()
+    {
+        T value;
+        while (pop(value))
+            ;
+    }
+    MpscQueue(const MpscQueue &) = delete;
+    MpscQueue &operator=(const MpscQueue &) = delete;
+
+    void push(T &&value) { push(new Node { { nullptr }, std::move(value) }); }
+
+    bool pop(T &value)
+    {
+        auto tail = _tail;
+        auto next = tail->next.load(std::memory_order_acquire);
+        if (tail == &_stub) {
+            if (!next)
+                return false;
+            _tail = next;
+            tail  = next;
+            next  = next->next.load(std::memory_order_acquire);
+        }
+        if (!next) {
+            if (tail != _head.load(std::memory_order_acquire))
+                return false; // a producer is in progress
+            _stub.next.store(nullptr, std::memory_order_relaxed);
+            push(&_stub);
+            next = tail->next.load(std::memory_order_acquire);
+            if (!next)
+                return false;
+        }
+        _tail = next;
+        value = std::move(tail->value);
+        delete tail;
+        return true;
+    }
+
+    // consumer only. a push in progress counts as not empty
+    bool empty() const
+    {
+        return _tail == &_stub && _head.load(std::memory_order_acquire) == &_stub;
+    }
+
+private:
+    struct Node {
+        std::atomic<Node *> next;
+        T                   value;
+    };
+
+    void push(Node *node)
+    {
+        auto prev = _head.exchange(node, std::memory_order_acq_rel);
+        prev->next.store(node, std::memory_order_release);
+    }
+
+    std::atomic<Node *> _head;
+    Node *              _tail;
+    Node                _stub { { nullptr }, T() };
+};
+
+} // namespace TM
+
+#endif // MPSCQUEUE_H
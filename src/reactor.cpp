@@ -27,8 +27,16 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <cstdlib>
+
+#include "exception.h"
+#include "log.h"
 #include "reactor.h"
 #include "reactor_epoll.h"
+#include "reactor_pool.h"
+#ifdef HAVE_IO_URING
+#include "reactor_uring.h"
+#endif
 
 namespace TM {
 
@@ -38,6 +46,30 @@ std::shared_ptr<Reactor> Reactor::factory(const std::string &name)
 {
     if (name == "epoll")
         return std::make_shared<ReactorEpoll>();
+    if (name == "epoll-et")
+        return std::make_shared<ReactorEpoll>(ReactorEpoll::EdgeTriggered);
+    if (name == "epoll-busy" || name.compare(0, 11, "epoll-busy:") == 0) {
+        auto reactor = std::make_shared<ReactorEpoll>();
+        auto usec    = name.size() > 11 ? std::strtoul(name.c_str() + 11, nullptr, 10) : 50;
+        reactor->setBusyPoll(std::chrono::microseconds(usec));
+        return reactor;
+    }
+    if (name == "io_uring" || name == "io_uring-sqpoll") {
+#ifdef HAVE_IO_URING
+        try {
+            return std::make_shared<ReactorUring>(name == "io_uring-sqpoll");
+        } catch (ReactorException &e) {
+            Log("Falling back to epoll: ") << e.what();
+        }
+#else
+        Log("Built without io_uring support. Falling back to epoll");
+#endif
+        return std::make_shared<ReactorEpoll>();
+    }
+    if (name == "pool")
+        return std::make_shared<ReactorPool>();
+    if (name.compare(0, 5, "pool:") == 0)
+        return std::make_shared<ReactorPool>(std::strtoul(name.c_str() + 5, nullptr, 10));
     return std::shared_ptr<Reactor>();
 }
 
@@ -30,19 +30,47 @@
 #ifndef REACTOR_H
 #define REACTOR_H
 
+#include <chrono>
+#include <functional>
 #include <memory>
+#include <string>
 
 #include "device.h"
+#include "reactorstats.h"
 
 namespace TM {
 
 class Reactor : public std::enable_shared_from_this<Reactor> {
 public:
+    using TimerId = std::uint64_t;
+
+    static constexpr TimerId InvalidTimer = 0;
+
     virtual ~Reactor();
     virtual void start()                                   = 0;
+    // stop() and post() are safe to call from any thread. the rest has to be called from the
+    // reactor's thread: the one running start(), or the one which created the reactor while it
+    // doesn't run. so a reactor started on another thread is set up before that thread is
+    // spawned or by posted tasks. posted tasks run on the reactor's thread in FIFO order
     virtual void stop()                                    = 0;
+    virtual void post(std::function<void()> task)          = 0;
     virtual void addDevice(std::shared_ptr<Device> dev)    = 0;
     virtual void removeDevice(std::shared_ptr<Device> dev) = 0;
+    // the device changed its interest (e.g. Device::setWriteInterest)
+    virtual void updateDevice(std::shared_ptr<Device> dev) = 0;
+
+    // monotonic time used by the reactor's timers
+    virtual std::chrono::milliseconds now() const = 0;
+    // single shot timer fired on the reactor's thread. cancelling fired timer is a no-op.
+    // both are safe from any thread, but a cancel from another one may come too late to stop a
+    // timer which is due already
+    virtual TimerId addTimer(std::chrono::milliseconds timeout, std::function<void()> callback) = 0;
+    virtual void    cancelTimer(TimerId id) = 0;
+
+    // instrumentation is off by default. without TM_REACTOR_STATS it's compiled out completely.
+    // stats() may be called from any thread
+    virtual void         setStatsEnabled(bool enabled) = 0;
+    virtual ReactorStats stats() const                 = 0;
 
     static std::shared_ptr<Reactor> factory(const std::string &name);
 
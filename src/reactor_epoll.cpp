@@ -27,8 +27,11 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
-#include <sstream>
+#include <algorithm>
+#include <errno.h>
+#include <string.h>
 #include <sys/epoll.h>
+#include <sys/socket.h>
 #include <unistd.h>
 
 #include "exception.h"
@@ -37,83 +40,109 @@
 
 namespace TM {
 
-ReactorEpoll::ReactorEpoll()
+ReactorEpoll::ReactorEpoll(Trigger trigger) :
+    ReactorLoop(trigger == EdgeTriggered), _trigger(trigger)
 {
     _epfd = epoll_create1(0);
     if (_epfd < 0) {
         throw ReactorException("Failed to init reactor");
     }
+    initWakeup();
 }
 
-ReactorEpoll::~ReactorEpoll()
+ReactorEpoll::~ReactorEpoll() { close(_epfd); }
+
+void ReactorEpoll::setBusyPoll(std::chrono::microseconds budget)
 {
-    if (_active)
-        Log("Destroying active reactor. Something went terribly wrong.");
+    _busyPoll = std::max(budget, std::chrono::microseconds(0));
+}
 
-    close(_epfd);
+bool ReactorEpoll::addFd(int fd, std::uint64_t token, std::uint32_t events)
+{
+    if (_busyPoll.count() && token != WakeToken)
+        setSocketBusyPoll(fd);
+    return ctl(EPOLL_CTL_ADD, fd, token, events);
 }
 
-void ReactorEpoll::start()
+bool ReactorEpoll::modifyFd(int fd, std::uint64_t token, std::uint32_t events)
 {
-    _active = true;
-
-    epoll_event events[MaxEvents];
-    while (_active) {
-        int n = epoll_wait(_epfd, events, MaxEvents, -1);
-        if (n == -1) {
-            Log::syserr("epoll_wait failed");
-            break;
-        }
-        for (int i = 0; i < n; i++) {
-            auto &ev = events[i];
-            // auto  userData = reinterpret_cast<UserData *>(ev.data.ptr);
-            // auto  dev      = userData->device.lock();
-            auto devIt = _devices.find(ev.data.fd);
-            if (devIt == _devices.end()) {
-                epoll_ctl(_epfd, EPOLL_CTL_DEL, ev.data.fd, nullptr);
-                continue;
-            }
-            auto dev = devIt->second;
-
-            if (ev.events & EPOLLHUP || ev.events & EPOLLERR) {
-                std::ostringstream ss;
-                ss << "Got unexpected events " << ev.events;
-                _active = false;
-                throw ReactorException(ss.str());
-            }
-
-            if (ev.events & EPOLLIN)
-                dev->on_readyRead();
-
-            if (ev.events & EPOLLOUT)
-                dev->on_readyWrite();
-        }
-    }
-    _active = false;
+    return ctl(EPOLL_CTL_MOD, fd, token, events);
 }
 
-void ReactorEpoll::stop() { _active = false; }
+void ReactorEpoll::removeFd(int fd) { epoll_ctl(_epfd, EPOLL_CTL_DEL, fd, nullptr); }
 
-void ReactorEpoll::addDevice(std::shared_ptr<Device> dev)
+int ReactorEpoll::wait(Event *events, int maxEvents, int timeout)
 {
-    auto fd = dev->fileDescriptor();
-    if (fd == -1)
-        throw ReactorException("Device is not open");
-    _devices.insert(std::make_pair(fd, dev));
+    if (!_busyPoll.count() || timeout == 0)
+        return poll(events, maxEvents, timeout);
+
+    // spin with zero timeout until something arrives, the budget is spent or a timer is due.
+    using Clock   = std::chrono::steady_clock;
+    auto start    = Clock::now();
+    auto deadline = start + _busyPoll;
+    if (timeout > 0)
+        deadline = std::min(deadline, start + std::chrono::milliseconds(timeout));
+    Clock::time_point now;
+    do {
+        int n = poll(events, maxEvents, 0);
+        if (n != 0)
+            return n;
+        now = Clock::now();
+    } while (now < deadline);
+
+    if (timeout > 0) {
+        auto spent = std::chrono::duration_cast<std::chrono::milliseconds>(now - start).count();
+        timeout    = std::max(0, timeout - int(spent));
+    }
+    return poll(events, maxEvents, timeout);
+}
 
-    epoll_event ev;
-    ev.data.fd = fd;
-    ev.events  = EPOLLIN | EPOLLOUT;
-    if (epoll_ctl(_epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
-        Log::syserr("Failed to add fd to epoll") << " fd=" << fd;
+int ReactorEpoll::poll(Event *events, int maxEvents, int timeout)
+{
+    epoll_event epevents[MaxEvents];
+    int         n = epoll_wait(_epfd, epevents, std::min(maxEvents, int(MaxEvents)), timeout);
+    for (int i = 0; i < n; i++) {
+        auto &ev  = epevents[i];
+        auto &out = events[i];
+        out.token  = ev.data.u64;
+        out.events = 0;
+        if (ev.events & EPOLLIN)
+            out.events |= Readable;
+        if (ev.events & EPOLLOUT)
+            out.events |= Writable;
+        if (ev.events & EPOLLHUP)
+            out.events |= Hangup;
+        if (ev.events & EPOLLERR)
+            out.events |= Error;
+    }
+    return n;
+}
+
+void ReactorEpoll::setSocketBusyPoll(int fd)
+{
+    int usec = int(std::min<std::chrono::microseconds::rep>(_busyPoll.count(), INT32_MAX));
+    if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec)) == 0 || errno == ENOTSOCK)
+        return;
+    // raising it above net.core.busy_poll needs CAP_NET_ADMIN. the loop still spins without it.
+    if (!_busyPollWarned) {
+        _busyPollWarned = true;
+        Log("Failed to set SO_BUSY_POLL: ") << strerror(errno);
     }
 }
 
-void ReactorEpoll::removeDevice(std::shared_ptr<Device> dev)
+bool ReactorEpoll::ctl(int op, int fd, std::uint64_t token, std::uint32_t events)
 {
-    auto fd = dev->fileDescriptor();
-    epoll_ctl(_epfd, EPOLL_CTL_DEL, fd, nullptr);
-    _devices.erase(fd);
+    epoll_event ev;
+    ev.data.u64 = token;
+    ev.events   = 0;
+    if (events & Readable)
+        ev.events |= EPOLLIN;
+    if (events & Writable)
+        ev.events |= EPOLLOUT;
+    // the wakeup eventfd is always level triggered
+    if (_trigger == EdgeTriggered && token != WakeToken)
+        ev.events |= EPOLLET;
+    return epoll_ctl(_epfd, op, fd, &ev) == 0;
 }
 
 } // namespace TM
@@ -30,35 +30,48 @@
 #ifndef REACTOREPOLL_H
 #define REACTOREPOLL_H
 
-#include <map>
-#include <memory>
-#include <unordered_map>
+#include <chrono>
 
-#include "reactor.h"
+#include "reactor_loop.h"
 
 namespace TM {
 
-class ReactorEpoll : public Reactor {
+class ReactorEpoll : public ReactorLoop {
 public:
-    ReactorEpoll();
+    enum Trigger : uint8_t {
+        LevelTriggered,
+        EdgeTriggered // devices are expected to read till EAGAIN. see Device::dispatchRead
+    };
+
+    ReactorEpoll(Trigger trigger = LevelTriggered);
     ~ReactorEpoll();
 
-    void start();
-    void stop();
+    /**
+     * @brief setBusyPoll enables low-latency mode.
+     * Before blocking in epoll_wait the loop polls with zero timeout for up to \a budget,
+     * and registered sockets get SO_BUSY_POLL with the same budget. Zero disables it.
+     * Call before start() or from the loop thread.
+     */
+    void                      setBusyPoll(std::chrono::microseconds budget);
+    std::chrono::microseconds busyPoll() const { return _busyPoll; }
 
-    void addDevice(std::shared_ptr<Device> dev);
-    void removeDevice(std::shared_ptr<Device> dev);
+protected:
+    bool addFd(int fd, std::uint64_t token, std::uint32_t events);
+    bool modifyFd(int fd, std::uint64_t token, std::uint32_t events);
+    void removeFd(int fd);
+    int  wait(Event *events, int maxEvents, int timeout);
 
 private:
-    struct UserData {
-        int                   fd;
-        std::weak_ptr<Device> device;
-    };
     static const int MaxEvents = 16;
 
-    bool                                   _active = false;
-    int                                    _epfd   = -1;
-    std::map<int, std::shared_ptr<Device>> _devices;
+    bool ctl(int op, int fd, std::uint64_t token, std::uint32_t events);
+    int  poll(Event *events, int maxEvents, int timeout);
+    void setSocketBusyPoll(int fd);
+
+    Trigger                   _trigger;
+    int                       _epfd = -1;
+    std::chrono::microseconds _busyPoll { 0 };
+    bool                      _busyPollWarned = false;
 };
 
 } // namespace TM
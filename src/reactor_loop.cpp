@@ -0,0 +1,360 @@
+/*
+ * Copyright (c) 2020 Sergey Ilinykh <rion4ik@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of mosquitto nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "exception.h"
+#include "log.h"
+#include "reactor_loop.h"
+
+namespace TM {
+
+ReactorLoop::ReactorLoop(bool drain) : ReactorLoop(drain, ReactorLoop::now()) { }
+
+ReactorLoop::ReactorLoop(bool drain, std::chrono::milliseconds epoch) :
+    _drain(drain), _owner(std::this_thread::get_id()), _loopThread(_owner),
+    _timers(std::uint64_t(epoch.count()))
+{
+    // used to interrupt waiting from other threads
+    _wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (_wakefd < 0) {
+        throw ReactorException("Failed to init reactor wakeup");
+    }
+}
+
+ReactorLoop::~ReactorLoop()
+{
+    if (_active)
+        Log("Destroying active reactor. Something went terribly wrong.");
+
+    close(_wakefd);
+}
+
+void ReactorLoop::initWakeup()
+{
+    if (!addFd(_wakefd, WakeToken, Readable))
+        throw ReactorException("Failed to init reactor wakeup");
+}
+
+void ReactorLoop::start()
+{
+    _loopThread = std::this_thread::get_id();
+    _active     = true;
+
+    Event events[MaxEvents];
+    while (!_stopRequested) {
+        auto iterationStart = _stats.now();
+        runTasks();
+        applyChanges();
+
+        int  timeout = -1;
+        auto expires = _timers.nextExpiry();
+        if (!_tasks.empty()) {
+            timeout = 0; // posted while the changes were applied, or a push in progress
+        } else if (expires != TimerWheel::NoTimers) {
+            auto ms = std::uint64_t(now().count());
+            timeout = expires <= ms ? 0 : int(std::min<std::uint64_t>(expires - ms, INT_MAX));
+        }
+
+        auto waitStart = _stats.now();
+        int  n         = wait(events, MaxEvents, timeout);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            Log::syserr("reactor wait failed");
+            break;
+        }
+        auto waitEnd = _stats.now();
+        for (int i = 0; i < n; i++)
+            dispatch(events[i]);
+
+        _timers.advance(now().count());
+        _graveyard.clear();
+
+        if (_stats.enabled())
+            _stats.wakeup(n, waitEnd - waitStart,
+                          (waitStart - iterationStart) + (_stats.now() - waitEnd));
+    }
+    _graveyard.clear();
+    _active        = false;
+    _stopRequested = false;
+    _loopThread    = _owner;
+}
+
+void ReactorLoop::post(std::function<void()> task)
+{
+    _tasks.push(std::move(task));
+    // the loop thread drains the queue before it waits again, no need to wake it up. other
+    // threads need one eventfd write for any number of tasks posted till the loop picks them up
+    if (!isInLoopThread() && !_wakeupPending.exchange(true))
+        wakeup();
+}
+
+void ReactorLoop::runTasks()
+{
+    // cleared before draining, so a task pushed after the drain started brings another wakeup
+    _wakeupPending = false;
+    std::function<void()> task;
+    while (_tasks.pop(task))
+        task();
+}
+
+bool ReactorLoop::isInLoopThread() const
+{
+    return _loopThread.load() == std::this_thread::get_id();
+}
+
+void ReactorLoop::dispatch(const Event &ev)
+{
+    if (ev.token == WakeToken) {
+        eventfd_t value;
+        eventfd_read(_wakefd, &value);
+        return;
+    }
+
+    // the token is generation:fd, so events of removed or reused fds are recognized as stale
+    auto fd = std::uint32_t(ev.token);
+    if (fd >= _slots.size() || _slots[fd].generation != std::uint32_t(ev.token >> 32)
+        || !_slots[fd].device)
+        return;
+
+    // removed devices are kept alive till the end of the iteration, so a raw pointer is safe
+    auto dev = _slots[fd].device.get();
+    if (dev->fileDescriptor() != int(fd))
+        return; // closed from another thread. removal is already posted
+
+    if (ev.events & Receive)
+        dev->receive(std::span<const std::byte>(ev.data, ev.size));
+
+    // hangup and error are reported to the device as readability. reading gives it the rest of
+    // the input and then EOF or the error (see Device::atEnd)
+    if (ev.events & (Readable | Hangup | Error | Receive)) {
+        auto start = _stats.now();
+        dev->dispatchRead(_drain);
+        if (_stats.enabled())
+            _stats.callback(*dev, ev.token, _stats.now() - start);
+    }
+
+    // the device may be removed by the read handler
+    if (ev.events & Writable && _slots[fd].generation == std::uint32_t(ev.token >> 32)
+        && _slots[fd].device && dev->writeInterest()) {
+        auto start = _stats.now();
+        dev->dispatchWrite();
+        if (_stats.enabled())
+            _stats.callback(*dev, ev.token, _stats.now() - start);
+    }
+}
+
+void ReactorLoop::stop()
+{
+    _stopRequested = true;
+    wakeup();
+}
+
+void ReactorLoop::wakeup() { eventfd_write(_wakefd, 1); }
+
+void ReactorLoop::addDevice(std::shared_ptr<Device> dev)
+{
+    auto fd = dev->fileDescriptor();
+    if (fd == -1)
+        throw ReactorException("Device is not open");
+    if (!isInLoopThread()) {
+        _deviceCount++; // counted right away for ReactorPool balancing
+        post([this, dev]() {
+            _deviceCount--;
+            if (dev->fileDescriptor() != -1)
+                addDevice(dev);
+        });
+        return;
+    }
+
+    if (std::size_t(fd) >= _slots.size())
+        _slots.resize(std::size_t(fd) + 1);
+    auto &slot = _slots[fd];
+    if (slot.device)
+        _graveyard.push_back(std::move(slot.device)); // stale device of a closed fd
+    else
+        _deviceCount++;
+    dev->setReceiving(_receiving);
+    slot.device = dev;
+    slot.events = eventsFor(*dev);
+    slot.generation++;
+
+    if (!addFd(fd, tokenOf(fd), slot.events)) {
+        Log::syserr("Failed to add fd to reactor") << " fd=" << fd;
+    }
+}
+
+void ReactorLoop::removeDevice(std::shared_ptr<Device> dev)
+{
+    // the fd is likely closed right after this call, so remember it now
+    auto fd = dev->fileDescriptor();
+    if (!isInLoopThread()) {
+        post([this, fd, dev]() { doRemoveDevice(fd, dev); });
+        return;
+    }
+    doRemoveDevice(fd, dev);
+}
+
+void ReactorLoop::doRemoveDevice(int fd, const std::shared_ptr<Device> &dev)
+{
+    if (fd < 0 || std::size_t(fd) >= _slots.size() || _slots[fd].device != dev)
+        return;
+    removeFd(fd);
+    auto &slot = _slots[fd];
+    // outside of the loop nobody can be dispatching to it
+    if (_active)
+        _graveyard.push_back(std::move(slot.device));
+    else
+        slot.device.reset();
+    slot.generation++;
+    dev->setReceiving(false);
+    _deviceCount--;
+}
+
+void ReactorLoop::updateDevice(std::shared_ptr<Device> dev)
+{
+    if (!isInLoopThread()) {
+        post([this, dev]() { updateDevice(dev); });
+        return;
+    }
+    auto fd = dev->fileDescriptor();
+    if (fd == -1)
+        return;
+    // applied in batch right before the next wait
+    if (std::size_t(fd) < _slots.size() && _slots[fd].device == dev && !_slots[fd].changed) {
+        _slots[fd].changed = true;
+        _changes.push_back(fd);
+    }
+}
+
+void ReactorLoop::applyChanges()
+{
+    for (auto fd : _changes) {
+        auto &slot   = _slots[fd];
+        slot.changed = false;
+        if (!slot.device)
+            continue;
+        auto events = eventsFor(*slot.device);
+        if (events == slot.events)
+            continue; // e.g. interest was toggled back and forth within one iteration
+        if (!modifyFd(fd, tokenOf(fd), events)) {
+            Log::syserr("Failed to modify fd in reactor") << " fd=" << fd;
+            continue;
+        }
+        slot.events = events;
+    }
+    _changes.clear();
+}
+
+std::uint64_t ReactorLoop::tokenOf(int fd) const
+{
+    return (std::uint64_t(_slots[fd].generation) << 32) | std::uint32_t(fd);
+}
+
+std::uint32_t ReactorLoop::eventsFor(const Device &dev) const
+{
+    std::uint32_t events = Readable;
+    if (dev.writeInterest())
+        events |= Writable;
+    if (dev.receiveInterest())
+        events |= Receive;
+    return events;
+}
+
+std::chrono::milliseconds ReactorLoop::now() const
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch());
+}
+
+Reactor::TimerId ReactorLoop::addTimer(std::chrono::milliseconds timeout,
+                                       std::function<void()>    callback)
+{
+    auto expires = std::uint64_t((now() + timeout).count());
+    if (isInLoopThread())
+        return _timers.schedule(expires, std::move(callback));
+
+    // the wheel never gives out ids with zero generation (the upper half), so these don't clash
+    TimerId id;
+    while (!(id = ++_postedTimerSeq))
+        ;
+    post([this, id, expires, callback = std::move(callback)]() mutable {
+        postedScheduled(id);
+        if (_cancelledPosted.erase(id))
+            return;
+        _postedTimers[id] = _timers.schedule(expires, [this, id, callback = std::move(callback)]() {
+            _postedTimers.erase(id);
+            callback();
+        });
+    });
+    return id;
+}
+
+void ReactorLoop::cancelTimer(TimerId id)
+{
+    if (!isInLoopThread()) {
+        post([this, id]() { cancelTimer(id); });
+        return;
+    }
+    if (id >> 32) {
+        _timers.cancel(id);
+        return;
+    }
+    auto it = _postedTimers.find(id);
+    if (it != _postedTimers.end()) {
+        _timers.cancel(it->second);
+        _postedTimers.erase(it);
+    } else if (id != InvalidTimer && !postedDone(id)) {
+        // its task is still queued, maybe behind a push in progress. the task drops the timer
+        _cancelledPosted.insert(id);
+    }
+}
+
+static std::uint32_t nextPosted(std::uint32_t id) { return ++id ? id : 1; }
+
+void ReactorLoop::postedScheduled(TimerId id)
+{
+    // the tasks run nearly in the order the ids were handed out, so the ids of the ones which
+    // ran are kept as a watermark and the few which got ahead of it
+    _postedAhead.insert(id);
+    for (auto next = nextPosted(_postedDone); _postedAhead.erase(next); next = nextPosted(next))
+        _postedDone = next;
+}
+
+bool ReactorLoop::postedDone(TimerId id) const
+{
+    return std::int32_t(std::uint32_t(id) - _postedDone) <= 0 || _postedAhead.count(id);
+}
+
+} // namespace TM
@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) 2020 Sergey Ilinykh <rion4ik@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of mosquitto nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef REACTORLOOP_H
+#define REACTORLOOP_H
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "mpscqueue.h"
+#include "reactor.h"
+#include "timerwheel.h"
+
+namespace TM {
+
+/**
+ * @brief ReactorLoop is a single threaded event loop with a pluggable readiness backend.
+ *
+ * It keeps the device table, batches interest changes, runs timers and dispatches events.
+ * Backends (epoll, io_uring) only register file descriptors and wait for events.
+ * All the state belongs to the loop thread. Device changes requested from other threads are
+ * forwarded through the lock-free task queue, so the loop itself never takes locks.
+ */
+class ReactorLoop : public Reactor {
+public:
+    ~ReactorLoop();
+
+    void start();
+    void stop();
+    void post(std::function<void()> task);
+
+    void addDevice(std::shared_ptr<Device> dev);
+    void removeDevice(std::shared_ptr<Device> dev);
+    void updateDevice(std::shared_ptr<Device> dev);
+
+    std::chrono::milliseconds now() const;
+    // timers of other threads are scheduled (and cancelled) by a posted task
+    TimerId addTimer(std::chrono::milliseconds timeout, std::function<void()> callback);
+    void    cancelTimer(TimerId id);
+
+    void         setStatsEnabled(bool enabled) { _stats.setEnabled(enabled); }
+    ReactorStats stats() const { return _stats.snapshot(); }
+
+    std::size_t deviceCount() const { return _deviceCount; }
+    // the thread running start(), or the one which created the loop while it doesn't run
+    bool        isInLoopThread() const;
+
+protected:
+    enum EventFlags : std::uint32_t {
+        Readable = 0x1,
+        Writable = 0x2,
+        Hangup   = 0x4,
+        Error    = 0x8,
+        // as interest: the backend reads the input itself instead of reporting readability.
+        // as event: data holds what it read, nothing means the end of stream
+        Receive = 0x10
+    };
+
+    struct Event {
+        std::uint64_t    token;
+        std::uint32_t    events;         // EventFlags
+        const std::byte *data = nullptr; // valid till the next wait()
+        std::size_t      size = 0;
+    };
+
+    static constexpr std::uint64_t WakeToken = UINT64_MAX;
+
+    // with drain=true devices are asked to read till the input is exhausted (edge triggered)
+    ReactorLoop(bool drain);
+    // for reactors with their own clock. epoch is the value of now() at construction
+    ReactorLoop(bool drain, std::chrono::milliseconds epoch);
+
+    // has to be called by the derived constructor once the backend is ready
+    void initWakeup();
+    // interrupts wait() from any thread
+    void wakeup();
+    // the backend supports Receive interest. has to be called before any device is added
+    void setReceiving(bool enabled) { _receiving = enabled; }
+
+    virtual bool addFd(int fd, std::uint64_t token, std::uint32_t events)    = 0;
+    virtual bool modifyFd(int fd, std::uint64_t token, std::uint32_t events) = 0;
+    virtual void removeFd(int fd)                                            = 0;
+    // returns number of events, 0 on timeout, -1 on error with errno set
+    virtual int wait(Event *events, int maxEvents, int timeout) = 0;
+
+private:
+    struct Slot {
+        std::shared_ptr<Device> device;
+        std::uint32_t           events     = 0;     // currently registered in backend
+        std::uint32_t           generation = 0;     // bumped on every add/remove of the fd
+        bool                    changed    = false; // queued in _changes
+    };
+    static const int MaxEvents = 16;
+
+    void          applyChanges();
+    void          runTasks();
+    void          doRemoveDevice(int fd, const std::shared_ptr<Device> &dev);
+    std::uint64_t tokenOf(int fd) const;
+    std::uint32_t eventsFor(const Device &dev) const;
+    void          dispatch(const Event &ev);
+    void          postedScheduled(TimerId id);
+    bool          postedDone(TimerId id) const; // the task of the posted timer has run
+
+    bool                                 _drain;
+    bool                                 _receiving = false;
+    std::atomic<bool>                    _active { false };
+    std::atomic<bool>                    _stopRequested { false };
+    std::atomic<bool>                    _wakeupPending { false };
+    std::thread::id                      _owner; // the loop thread while it's not started
+    std::atomic<std::thread::id>         _loopThread;
+    std::atomic<std::size_t>             _deviceCount { 0 };
+    int                                  _wakefd = -1;
+    MpscQueue<std::function<void()>>     _tasks;
+    std::vector<Slot>                    _slots; // indexed by fd
+    std::vector<int>                     _changes;
+    std::vector<std::shared_ptr<Device>> _graveyard; // removed during the current iteration
+    TimerWheel                           _timers;
+    // timers added from other threads have ids of their own, mapped to the wheel's ones once
+    // the posted task schedules them
+    std::atomic<std::uint32_t>           _postedTimerSeq { 0 };
+    std::uint32_t                        _postedDone = 0; // the tasks of all the ids till it ran
+    std::unordered_set<TimerId>          _postedAhead;    // ran, past _postedDone
+    std::unordered_map<TimerId, TimerId> _postedTimers;
+    std::unordered_set<TimerId>          _cancelledPosted; // before their task ran
+    ReactorStatsRecorder                 _stats;
+};
+
+} // namespace TM
+
+#endif // REACTORLOOP_H
@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) 2020 Sergey Ilinykh <rion4ik@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of mosquitto nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <exception>
+#include <mutex>
+
+#include "log.h"
+#include "reactor_epoll.h"
+#include "reactor_pool.h"
+
+namespace TM {
+
+// the loop running on the current thread, if the thread belongs to any pool
+static thread_local ReactorEpoll *currentLoop = nullptr;
+
+ReactorPool::ReactorPool(std::size_t threads, Balancing balancing) : _balancing(balancing)
+{
+    if (!threads)
+        threads = std::thread::hardware_concurrency();
+    if (!threads)
+        threads = 1;
+    if (threads > MaxLoops)
+        threads = MaxLoops;
+
+    _loops.reserve(threads);
+    for (std::size_t i = 0; i < threads; i++)
+        _loops.push_back(std::make_shared<ReactorEpoll>());
+}
+
+ReactorPool::~ReactorPool()
+{
+    if (!_threads.empty())
+        Log("Destroying active reactor pool. Something went terribly wrong.");
+}
+
+void ReactorPool::start()
+{
+    std::mutex         errorMutex;
+    std::exception_ptr error;
+
+    _threads.reserve(_loops.size());
+    for (auto &loop : _loops) {
+        _threads.emplace_back([this, loop, &errorMutex, &error]() {
+            currentLoop = loop.get();
+            try {
+                loop->start();
+            } catch (...) {
+                {
+                    std::lock_guard<std::mutex> lock(errorMutex);
+                    if (!error)
+                        error = std::current_exception();
+                }
+                stop();
+            }
+            currentLoop = nullptr;
+        });
+    }
+    for (auto &t : _threads)
+        t.join();
+    _threads.clear();
+
+    if (error)
+        std::rethrow_exception(error);
+}
+
+void ReactorPool::stop()
+{
+    for (auto &loop : _loops)
+        loop->stop();
+}
+
+void ReactorPool::post(std::function<void()> task) { _loops[selectLoop()]->post(std::move(task)); }
+
+std::shared_ptr<Reactor> ReactorPool::selectReactor() { return _loops[selectLoop()]; }
+
+void ReactorPool::addDevice(std::shared_ptr<Device> dev)
+{
+    auto loop = _loops[selectLoop()];
+    dev->setReactor(loop);
+    loop->addDevice(dev);
+}
+
+void ReactorPool::removeDevice(std::shared_ptr<Device> dev)
+{
+    // normally devices talk to their loop directly after addDevice
+    for (auto &loop : _loops)
+        loop->removeDevice(dev);
+}
+
+void ReactorPool::updateDevice(std::shared_ptr<Device> dev)
+{
+    for (auto &loop : _loops)
+        loop->updateDevice(dev);
+}
+
+std::chrono::milliseconds ReactorPool::now() const { return _loops.front()->now(); }
+
+Reactor::TimerId ReactorPool::addTimer(std::chrono::milliseconds timeout,
+                                       std::function<void()>    callback)
+{
+    auto idx = selectLoop();
+    return _loops[idx]->addTimer(timeout, std::move(callback)) | (TimerId(idx) << LoopIdShift);
+}
+
+void ReactorPool::cancelTimer(TimerId id)
+{
+    auto idx = std::size_t(id >> LoopIdShift);
+    if (idx < _loops.size())
+        _loops[idx]->cancelTimer(id & ((TimerId(1) << LoopIdShift) - 1));
+}
+
+void ReactorPool::setStatsEnabled(bool enabled)
+{
+    for (auto &loop : _loops)
+        loop->setStatsEnabled(enabled);
+}
+
+ReactorStats ReactorPool::stats() const
+{
+    ReactorStats ret;
+    for (auto &loop : _loops)
+        ret.merge(loop->stats());
+    return ret;
+}
+
+std::size_t ReactorPool::selectLoop()
+{
+    for (std::size_t i = 0; i < _loops.size(); i++)
+        if (_loops[i].get() == currentLoop)
+            return i;
+
+    if (_balancing == RoundRobin)
+        return _next++ % _loops.size();
+
+    std::size_t best      = 0;
+    std::size_t bestCount = _loops.front()->deviceCount();
+    for (std::size_t i = 1; i < _loops.size() && bestCount; i++) {
+        auto count = _loops[i]->deviceCount();
+        if (count < bestCount) {
+            best      = i;
+            bestCount = count;
+        }
+    }
+    return best;
+}
+
+} // namespace TM
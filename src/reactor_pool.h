@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2020 Sergey Ilinykh <rion4ik@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of mosquitto nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef REACTORPOOL_H
+#define REACTORPOOL_H
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "reactor.h"
+
+namespace TM {
+
+class ReactorEpoll;
+
+/**
+ * @brief ReactorPool runs one ReactorEpoll per thread and shards devices between them.
+ *
+ * Once a device is added it's bound to its loop (Device::setReactor is updated), so all its
+ * callbacks are executed on the same thread. Devices added from within a pool thread stay on
+ * that thread, which keeps e.g. redirect hops of the same HttpClient together.
+ */
+class ReactorPool : public Reactor {
+public:
+    enum Balancing : uint8_t { RoundRobin, LeastLoaded };
+
+    ReactorPool(std::size_t threads = 0, Balancing balancing = LeastLoaded);
+    ~ReactorPool();
+
+    void start();
+    void stop();
+    // runs the task on the current loop or on the one selected by balancing policy
+    void post(std::function<void()> task);
+
+    void addDevice(std::shared_ptr<Device> dev);
+    void removeDevice(std::shared_ptr<Device> dev);
+    void updateDevice(std::shared_ptr<Device> dev);
+
+    std::chrono::milliseconds now() const;
+    // the timer is bound to the current loop or to the one selected by balancing policy
+    TimerId addTimer(std::chrono::milliseconds timeout, std::function<void()> callback);
+    void    cancelTimer(TimerId id);
+
+    void setStatsEnabled(bool enabled);
+    // merged statistics of all the loops
+    ReactorStats stats() const;
+
+    std::size_t size() const { return _loops.size(); }
+    // the loop a device added now would go to. a group of devices and timers which must not
+    // run concurrently (e.g. a socket with its connection attempts) is bound to it up front
+    std::shared_ptr<Reactor> selectReactor();
+
+private:
+    static const int         LoopIdShift = 56; // loop index is kept in the top byte of timer ids
+    static const std::size_t MaxLoops    = 256;
+
+    std::size_t selectLoop();
+
+    Balancing                                  _balancing;
+    std::atomic<std::size_t>                   _next { 0 };
+    std::vector<std::shared_ptr<ReactorEpoll>> _loops;
+    std::vector<std::thread>                   _threads;
+};
+
+} // namespace TM
+
+#endif // REACTORPOOL_H
@@ -0,0 +1,290 @@
+/*
+ * Copyright (c) 2020 Sergey Ilinykh <rion4ik@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of mosquitto nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "reactor_sim.h"
+
+namespace TM {
+
+static const std::uint64_t Never = UINT64_MAX;
+
+ReactorSim::ReactorSim() : ReactorLoop(false, std::chrono::milliseconds(0)) { initWakeup(); }
+
+ReactorSim::~ReactorSim()
+{
+    for (auto &conn : _connections)
+        if (conn->_fd != -1)
+            ::close(conn->_fd);
+}
+
+void ReactorSim::listen(const std::string &host, std::uint16_t port, Handler handler, Link link)
+{
+    _endpoints[std::make_pair(host, port)] = Endpoint { std::move(handler), link };
+}
+
+void ReactorSim::listen(const std::string &host, std::uint16_t port, Handler handler)
+{
+    listen(host, port, std::move(handler), Link());
+}
+
+Socket::Connector ReactorSim::connector()
+{
+    std::weak_ptr<Reactor> weakSelf = shared_from_this();
+    return [weakSelf](const std::string &host, std::uint16_t port) {
+        auto self = weakSelf.lock();
+        return self ? static_cast<ReactorSim *>(self.get())->connect(host, port) : -1;
+    };
+}
+
+int ReactorSim::connect(const std::string &host, std::uint16_t port)
+{
+    auto it = _endpoints.find(std::make_pair(host, port));
+    if (it == _endpoints.end()) {
+        Log("Simulated connection refused: ") << host << ":" << port;
+        return -1;
+    }
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds) == -1) {
+        Log::syserr("failed to create socketpair");
+        return -1;
+    }
+    auto conn      = std::make_unique<Connection>();
+    conn->_sim     = this;
+    conn->_handler = it->second.handler;
+    conn->_host    = host;
+    conn->_port    = port;
+    conn->_link    = it->second.link;
+    conn->_fd      = fds[1];
+    _connections.push_back(std::move(conn));
+    return fds[0];
+}
+
+bool ReactorSim::addFd(int fd, std::uint64_t token, std::uint32_t events)
+{
+    _registered[fd] = Registration { token, events };
+    return true;
+}
+
+bool ReactorSim::modifyFd(int fd, std::uint64_t token, std::uint32_t events)
+{
+    return addFd(fd, token, events);
+}
+
+void ReactorSim::removeFd(int fd) { _registered.erase(fd); }
+
+int ReactorSim::wait(Event *events, int maxEvents, int timeout)
+{
+    int n = collect(events, maxEvents);
+    if (n || timeout == 0)
+        return n;
+
+    // nothing to do right now. jump to whatever happens first: the next action or the timeout
+    auto deadline = timeout < 0 ? Never : _now + std::uint64_t(timeout) * 1000;
+    auto next     = _actions.empty() ? Never : _actions.begin()->first;
+    if (next == Never && deadline == Never) {
+        Log("Simulation is out of events");
+        stop();
+        return 0;
+    }
+    _now = std::min(next, deadline);
+    return collect(events, maxEvents);
+}
+
+int ReactorSim::collect(Event *events, int maxEvents)
+{
+    runNetwork();
+
+    std::vector<pollfd> fds;
+    fds.reserve(_registered.size());
+    for (auto const &[fd, reg] : _registered) {
+        short mask = (reg.events & Readable ? POLLIN : 0) | (reg.events & Writable ? POLLOUT : 0);
+        fds.push_back(pollfd { fd, mask, 0 });
+    }
+    if (poll(fds.data(), fds.size(), 0) == -1)
+        return -1;
+
+    int n = 0;
+    for (auto const &pfd : fds) {
+        if (!pfd.revents || n == maxEvents)
+            continue;
+        auto &out  = events[n++];
+        out.token  = _registered[pfd.fd].token;
+        out.events = 0;
+        if (pfd.revents & POLLIN)
+            out.events |= Readable;
+        if (pfd.revents & POLLOUT)
+            out.events |= Writable;
+        if (pfd.revents & POLLHUP)
+            out.events |= Hangup;
+        if (pfd.revents & (POLLERR | POLLNVAL))
+            out.events |= Error;
+    }
+    return n;
+}
+
+void ReactorSim::runNetwork()
+{
+    // everything due by now, including what it triggers with zero latency
+    bool progress = true;
+    while (progress) {
+        progress = false;
+        for (std::size_t i = 0; i < _connections.size(); i++) {
+            auto &conn = *_connections[i];
+            if (conn._fd == -1)
+                continue;
+            progress |= flush(conn);
+            progress |= receive(conn);
+        }
+        while (!_actions.empty() && _actions.begin()->first <= _now) {
+            auto action = std::move(_actions.begin()->second);
+            _actions.erase(_actions.begin());
+            action();
+            progress = true;
+        }
+    }
+}
+
+void ReactorSim::schedule(std::uint64_t when, std::function<void()> action)
+{
+    _actions.emplace(std::max(when, _now), std::move(action));
+}
+
+std::uint64_t ReactorSim::transfer(std::uint64_t &busy, const Link &link, std::size_t size)
+{
+    // segments queue up on the link. each one takes size/bandwidth to transmit
+    auto start = std::max(_now, busy);
+    busy       = start + (link.bandwidth ? std::uint64_t(size) * 1000000 / link.bandwidth : 0);
+    return busy + std::uint64_t(link.latency.count()) * 1000;
+}
+
+void ReactorSim::deliver(Connection &conn, std::string &&data)
+{
+    if (conn._fd == -1)
+        return; // reset
+    conn._stalled += data;
+    flush(conn);
+}
+
+bool ReactorSim::flush(Connection &conn)
+{
+    if (!conn._stalled.empty()) {
+        auto sent = ::send(conn._fd, conn._stalled.data(), conn._stalled.size(), MSG_NOSIGNAL);
+        if (sent <= 0) {
+            if (sent == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+                conn._stalled.clear(); // the client is gone
+            return false;
+        }
+        conn._stalled.erase(0, std::size_t(sent));
+    }
+    if (conn._stalled.empty() && conn._shutdown) {
+        conn._shutdown = false;
+        shutdown(conn._fd, SHUT_WR);
+        return true;
+    }
+    return false;
+}
+
+bool ReactorSim::receive(Connection &conn)
+{
+    if (conn._clientClosed)
+        return false;
+    char buf[16384];
+    auto len = ::read(conn._fd, buf, sizeof(buf));
+    if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return false;
+
+    auto when = transfer(conn._upBusy, conn._link, len > 0 ? std::size_t(len) : 0);
+    if (len <= 0) {
+        conn._clientClosed = true;
+        schedule(when, [&conn]() {
+            if (conn._fd == -1)
+                return;
+            if (conn._handler)
+                conn._handler(conn, std::string());
+            ::close(conn._fd);
+            conn._fd = -1;
+        });
+        return true;
+    }
+    schedule(when, [&conn, data = std::string(buf, std::size_t(len))]() mutable {
+        if (conn._fd != -1 && conn._handler)
+            conn._handler(conn, std::move(data));
+    });
+    return true;
+}
+
+void ReactorSim::Connection::send(std::string data)
+{
+    if (!isOpen() || data.empty())
+        return;
+    auto segment = _link.maxSegment ? _link.maxSegment : data.size();
+    for (std::size_t pos = 0; pos < data.size(); pos += segment) {
+        auto chunk = data.substr(pos, segment);
+        auto when  = _sim->transfer(_downBusy, _link, chunk.size());
+        _sim->schedule(when, [this, chunk = std::move(chunk)]() mutable {
+            _sim->deliver(*this, std::move(chunk));
+        });
+    }
+}
+
+void ReactorSim::Connection::close()
+{
+    if (!isOpen())
+        return;
+    _closing  = true;
+    auto when = std::max(_sim->_now, _downBusy) + std::uint64_t(_link.latency.count()) * 1000;
+    _sim->schedule(when, [this]() {
+        if (_fd == -1)
+            return;
+        _shutdown = true;
+        _sim->flush(*this);
+    });
+}
+
+void ReactorSim::Connection::reset()
+{
+    if (_fd == -1)
+        return;
+    _closing = true;
+    _sim->schedule(_sim->_now + std::uint64_t(_link.latency.count()) * 1000, [this]() {
+        if (_fd == -1)
+            return;
+        _stalled.clear();
+        ::close(_fd);
+        _fd = -1;
+    });
+}
+
+} // namespace TM
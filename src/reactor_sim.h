@@ -0,0 +1,142 @@
+/*
+ * Copyright (c) 2020 Sergey Ilinykh <rion4ik@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of mosquitto nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef REACTORSIM_H
+#define REACTORSIM_H
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "reactor_loop.h"
+#include "socket.h"
+
+namespace TM {
+
+/**
+ * @brief ReactorSim is a single threaded reactor running in virtual time.
+ *
+ * Whenever nothing is ready the clock jumps to the next scheduled event (timer or packet
+ * arrival) instead of sleeping, so timeouts of minutes are simulated in microseconds and every
+ * run with the same input gives the same results. Sockets connected through its connector() talk
+ * to in-process endpoints registered with listen() over socketpairs, and the links between them
+ * add latency, limit bandwidth, split data into segments (partial reads) and may be reset.
+ * When nothing is left to happen the simulation stops by itself.
+ */
+class ReactorSim : public ReactorLoop {
+public:
+    struct Link {
+        std::chrono::milliseconds latency { 0 };  // one way
+        std::size_t               bandwidth  = 0; // bytes per second each way. 0 - unlimited
+        std::size_t               maxSegment = 0; // largest chunk delivered at once. 0 - unlimited
+    };
+
+    class Connection;
+    // receives data sent by the client. empty data means the client closed the connection
+    using Handler = std::function<void(Connection &, std::string &&)>;
+
+    // server side of a simulated connection
+    class Connection {
+    public:
+        // queues data to the client according to the link parameters
+        void send(std::string data);
+        // graceful close once everything sent so far has arrived
+        void close();
+        // abrupt close. data still in flight is lost
+        void reset();
+
+        const std::string &host() const { return _host; }
+        std::uint16_t      port() const { return _port; }
+        bool               isOpen() const { return _fd != -1 && !_closing; }
+
+    private:
+        friend class ReactorSim;
+
+        ReactorSim *  _sim;
+        Handler       _handler;
+        std::string   _host;
+        std::uint16_t _port;
+        Link          _link;
+        int           _fd;                   // our end of the socketpair
+        bool          _closing      = false; // close() or reset() was called
+        bool          _shutdown     = false; // shut down writing once _stalled is flushed
+        bool          _clientClosed = false; // EOF was read from the client
+        std::uint64_t _upBusy       = 0;     // when the link is free for the next transfer
+        std::uint64_t _downBusy     = 0;
+        std::string   _stalled;              // arrived but didn't fit into the socket buffer
+    };
+
+    ReactorSim();
+    ~ReactorSim();
+
+    // connections to host:port are served by the handler. the rest are refused
+    void listen(const std::string &host, std::uint16_t port, Handler handler, Link link);
+    void listen(const std::string &host, std::uint16_t port, Handler handler);
+
+    std::chrono::milliseconds now() const { return std::chrono::milliseconds(_now / 1000); }
+
+    // for Socket::setConnector and HttpClient::setConnector
+    Socket::Connector connector();
+
+protected:
+    bool addFd(int fd, std::uint64_t token, std::uint32_t events);
+    bool modifyFd(int fd, std::uint64_t token, std::uint32_t events);
+    void removeFd(int fd);
+    int  wait(Event *events, int maxEvents, int timeout);
+
+private:
+    struct Endpoint {
+        Handler handler;
+        Link    link;
+    };
+    struct Registration {
+        std::uint64_t token;
+        std::uint32_t events;
+    };
+
+    int           connect(const std::string &host, std::uint16_t port);
+    void          schedule(std::uint64_t when, std::function<void()> action);
+    std::uint64_t transfer(std::uint64_t &busy, const Link &link, std::size_t size);
+    void          deliver(Connection &conn, std::string &&data);
+    bool          flush(Connection &conn);
+    bool          receive(Connection &conn);
+    void          runNetwork();
+    int           collect(Event *events, int maxEvents);
+
+    std::uint64_t                                             _now = 0; // usec
+    std::map<std::pair<std::string, std::uint16_t>, Endpoint> _endpoints;
+    std::map<int, Registration>                         _registered; // ordered for determinism
+    std::vector<std::unique_ptr<Connection>>            _connections;
+    std::multimap<std::uint64_t, std::function<void()>> _actions; // FIFO within the same time
+};
+
+} // namespace TM
+
+#endif // REACTORSIM_H
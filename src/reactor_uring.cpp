@@ -0,0 +1,422 @@
+/*
+ * Copyright (c) 2020 Sergey Ilinykh <rion4ik@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of mosquitto nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "exception.h"
+#include "log.h"
+#include "reactor_uring.h"
+
+namespace TM {
+
+ReactorUring::ReactorUring(bool sqpoll) : ReactorLoop(false)
+{
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    if (sqpoll) {
+        params.flags          = IORING_SETUP_SQPOLL;
+        params.sq_thread_idle = 1000;
+    }
+    _ringfd = int(syscall(__NR_io_uring_setup, Entries, &params));
+    if (_ringfd < 0 && sqpoll) {
+        // unprivileged SQPOLL isn't allowed on older kernels
+        Log::syserr("io_uring SQPOLL setup failed. retrying without it");
+        memset(&params, 0, sizeof(params));
+        _ringfd = int(syscall(__NR_io_uring_setup, Entries, &params));
+    }
+    if (_ringfd < 0)
+        throw ReactorException(std::string("io_uring is not available: ") + strerror(errno));
+    _sqpoll = params.flags & IORING_SETUP_SQPOLL;
+
+    _sqRingSz = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    _cqRingSz = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        _sqRingSz = _cqRingSz = std::max(_sqRingSz, _cqRingSz);
+    _sqesSz = params.sq_entries * sizeof(io_uring_sqe);
+
+    auto map = [this](std::size_t size, off_t offset) {
+        auto ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringfd,
+                        offset);
+        return ptr == MAP_FAILED ? nullptr : ptr;
+    };
+    _sqRing = map(_sqRingSz, IORING_OFF_SQ_RING);
+    _cqRing = params.features & IORING_FEAT_SINGLE_MMAP ? _sqRing
+                                                         : map(_cqRingSz, IORING_OFF_CQ_RING);
+    _sqesMem = map(_sqesSz, IORING_OFF_SQES);
+    if (!_sqRing || !_cqRing || !_sqesMem) {
+        release();
+        throw ReactorException("Failed to map io_uring");
+    }
+
+    auto sq    = static_cast<char *>(_sqRing);
+    _sqHead    = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+    _sqTail    = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    _sqFlags   = reinterpret_cast<unsigned *>(sq + params.sq_off.flags);
+    _sqArray   = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+    _sqMask    = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    _sqEntries = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_entries);
+    _sqes      = static_cast<io_uring_sqe *>(_sqesMem);
+
+    auto cq = static_cast<char *>(_cqRing);
+    _cqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    _cqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    _cqMask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    _cqes   = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+
+    initWakeup();
+    setupBuffers();
+}
+
+ReactorUring::~ReactorUring() { release(); }
+
+void ReactorUring::release()
+{
+    if (_sqesMem)
+        munmap(_sqesMem, _sqesSz);
+    if (_cqRing && _cqRing != _sqRing)
+        munmap(_cqRing, _cqRingSz);
+    if (_sqRing)
+        munmap(_sqRing, _sqRingSz);
+    _sqesMem = _cqRing = _sqRing = nullptr;
+    if (_ringfd >= 0)
+        close(_ringfd);
+    _ringfd = -1;
+    if (_bufRing)
+        munmap(_bufRing, _bufRingSz);
+    _bufRing = nullptr;
+}
+
+bool ReactorUring::addFd(int fd, std::uint64_t token, std::uint32_t events)
+{
+    if (std::size_t(fd) >= _fds.size())
+        _fds.resize(std::size_t(fd) + 1);
+    auto &state = _fds[fd];
+    // requests of a closed and reused fd
+    disarm(fd, state);
+    cancelRecv(fd, state);
+    state = FdState { token, events, 0, 0, false, false, true };
+    // armed together with the next wait
+    _rearm.push_back(fd);
+    return true;
+}
+
+bool ReactorUring::modifyFd(int fd, std::uint64_t token, std::uint32_t events)
+{
+    if (std::size_t(fd) >= _fds.size() || !_fds[fd].registered)
+        return false;
+    auto &state  = _fds[fd];
+    state.token  = token;
+    state.events = events;
+    disarm(fd, state);
+    // the loop drops receive interest only right after a recv completed, so normally nothing
+    // is in flight here and no input is lost
+    if (!(events & Receive))
+        cancelRecv(fd, state);
+    _rearm.push_back(fd);
+    return true;
+}
+
+void ReactorUring::removeFd(int fd)
+{
+    if (fd < 0 || std::size_t(fd) >= _fds.size() || !_fds[fd].registered)
+        return;
+    auto &state = _fds[fd];
+    disarm(fd, state);
+    cancelRecv(fd, state);
+    state.registered = false;
+}
+
+int ReactorUring::wait(Event *events, int maxEvents, int timeout)
+{
+    // the data of the previous completions was taken by the devices
+    if (!_usedBuffers.empty()) {
+        for (auto bid : _usedBuffers)
+            provideBuffer(bid);
+        __atomic_store_n(&_bufRing->tail, _bufTail, __ATOMIC_RELEASE);
+        _usedBuffers.clear();
+    }
+
+    std::size_t failed = 0;
+    for (auto fd : _rearm) {
+        auto &state = _fds[fd];
+        if (state.registered && (!armRecv(fd, state) || !arm(fd, state)))
+            _rearm[failed++] = fd; // no room in the ring, tried again with the next wait
+    }
+    _rearm.resize(failed);
+
+    // completions left from the previous call because of maxEvents
+    if (*_cqHead != __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE) || failed)
+        timeout = 0;
+    if (timeout > 0) {
+        _timeout.tv_sec  = timeout / 1000;
+        _timeout.tv_nsec = (timeout % 1000) * 1000000L;
+
+        auto sqe = nextSqe();
+        if (sqe) {
+            sqe->opcode    = IORING_OP_TIMEOUT;
+            sqe->fd        = -1;
+            sqe->addr      = reinterpret_cast<std::uint64_t>(&_timeout);
+            sqe->len       = 1;
+            sqe->off       = 1; // or as soon as anything else completes
+            sqe->user_data = TimeoutData;
+        } else {
+            timeout = 0;
+        }
+    }
+    auto toSubmit = _toSubmit;
+    _toSubmit     = 0;
+
+    if (toSubmit || timeout != 0) {
+        unsigned minComplete = timeout != 0 ? 1 : 0;
+        if (enter(toSubmit, minComplete, minComplete ? IORING_ENTER_GETEVENTS : 0) < 0
+            && errno != EBUSY && errno != ETIME)
+            return -1;
+    }
+
+    int  n    = 0;
+    auto head = *_cqHead;
+    auto tail = __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE);
+    for (; head != tail && n < maxEvents; head++) {
+        auto &cqe = _cqes[head & _cqMask];
+        if (cqe.user_data == TimeoutData || cqe.user_data == RemoveData)
+            continue;
+
+        // the buffer goes back to the ring with the next wait, whether the data is wanted or not
+        const std::byte *data = nullptr;
+        if (cqe.flags & IORING_CQE_F_BUFFER) {
+            auto bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+            data     = _buffers.data() + bid * BufferSz;
+            _usedBuffers.push_back(bid);
+        }
+
+        auto fd  = std::uint32_t(cqe.user_data);
+        auto seq = std::uint32_t(cqe.user_data >> 32);
+        if (fd >= _fds.size())
+            continue;
+        auto &state = _fds[fd];
+        if (state.recvArmed && state.recvSeq == seq) {
+            state.recvArmed = false;
+            _rearm.push_back(fd);
+            // out of buffers, retried once they are given back
+            if (cqe.res == -ECANCELED || cqe.res == -ENOBUFS)
+                continue;
+
+            auto &out  = events[n++];
+            out.token  = state.token;
+            out.events = Receive;
+            out.data   = nullptr;
+            out.size   = 0;
+            if (cqe.res < 0) {
+                Log("io_uring recv failed: ") << strerror(-cqe.res) << " fd=" << fd;
+                out.events |= Error;
+            } else if (cqe.res > 0 && data) {
+                out.data = data;
+                out.size = std::size_t(cqe.res);
+            }
+            continue;
+        }
+
+        if (!state.armed || state.seq != seq)
+            continue; // cancelled or the fd was reused
+        state.armed = false;
+        _rearm.push_back(fd);
+        if (cqe.res == -ECANCELED)
+            continue;
+
+        auto &out  = events[n++];
+        out.token  = state.token;
+        out.events = 0;
+        out.data   = nullptr;
+        out.size   = 0;
+        if (cqe.res < 0) {
+            Log("io_uring poll failed: ") << strerror(-cqe.res) << " fd=" << fd;
+            out.events = Error;
+            continue;
+        }
+        if (cqe.res & POLLIN)
+            out.events |= Readable;
+        if (cqe.res & POLLOUT)
+            out.events |= Writable;
+        if (cqe.res & POLLHUP)
+            out.events |= Hangup;
+        if (cqe.res & POLLERR)
+            out.events |= Error;
+    }
+    __atomic_store_n(_cqHead, head, __ATOMIC_RELEASE);
+    return n;
+}
+
+io_uring_sqe *ReactorUring::nextSqe()
+{
+    auto tail = *_sqTail;
+    while (tail - __atomic_load_n(_sqHead, __ATOMIC_ACQUIRE) >= _sqEntries) {
+        // the ring is full. a slot is reused only once the kernel has read its entry, so the
+        // pending ones are submitted. the SQPOLL thread takes them by itself, it's waited for
+        if (enter(_toSubmit, 0, _sqpoll ? IORING_ENTER_SQ_WAIT : 0) < 0 && errno != EINTR) {
+            Log::syserr("io_uring submission failed");
+            return nullptr;
+        }
+        _toSubmit = 0;
+    }
+    auto idx = tail & _sqMask;
+    auto sqe = &_sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    _sqArray[idx] = idx;
+    __atomic_store_n(_sqTail, tail + 1, __ATOMIC_RELEASE);
+    _toSubmit++;
+    return sqe;
+}
+
+bool ReactorUring::arm(int fd, FdState &state)
+{
+    // received input tells readability and the end of stream by itself
+    std::uint32_t mask = 0;
+    if (state.events & Readable && !(state.events & Receive))
+        mask |= POLLIN;
+    if (state.events & Writable)
+        mask |= POLLOUT;
+    if (state.armed || !mask)
+        return true;
+
+    auto sqe = nextSqe();
+    if (!sqe)
+        return false;
+    state.seq          = ++_seq;
+    state.armed        = true;
+    sqe->opcode        = IORING_OP_POLL_ADD;
+    sqe->fd            = fd;
+    sqe->poll32_events = mask;
+    sqe->user_data     = (std::uint64_t(state.seq) << 32) | std::uint32_t(fd);
+    return true;
+}
+
+bool ReactorUring::armRecv(int fd, FdState &state)
+{
+    if (state.recvArmed || !(state.events & Receive))
+        return true;
+
+    auto sqe = nextSqe();
+    if (!sqe)
+        return false;
+    state.recvSeq   = ++_seq;
+    state.recvArmed = true;
+    sqe->opcode     = IORING_OP_RECV;
+    sqe->fd         = fd;
+    sqe->len        = BufferSz;
+    sqe->flags      = IOSQE_BUFFER_SELECT;
+    sqe->buf_group  = BufferGroup;
+    sqe->user_data  = (std::uint64_t(state.recvSeq) << 32) | std::uint32_t(fd);
+    return true;
+}
+
+void ReactorUring::disarm(int fd, FdState &state)
+{
+    if (!state.armed)
+        return;
+    state.armed = false;
+    auto sqe    = nextSqe();
+    if (!sqe)
+        return; // the completion is recognized as stale by its seq anyway
+    sqe->opcode    = IORING_OP_POLL_REMOVE;
+    sqe->fd        = -1;
+    sqe->addr      = (std::uint64_t(state.seq) << 32) | std::uint32_t(fd);
+    sqe->user_data = RemoveData;
+}
+
+void ReactorUring::cancelRecv(int fd, FdState &state)
+{
+    if (!state.recvArmed)
+        return;
+    state.recvArmed = false;
+    auto sqe        = nextSqe();
+    if (!sqe)
+        return;
+    sqe->opcode    = IORING_OP_ASYNC_CANCEL;
+    sqe->fd        = -1;
+    sqe->addr      = (std::uint64_t(state.recvSeq) << 32) | std::uint32_t(fd);
+    sqe->user_data = RemoveData;
+}
+
+int ReactorUring::enter(unsigned toSubmit, unsigned minComplete, unsigned flags)
+{
+    if (_sqpoll) {
+        // the kernel thread consumes submissions by itself unless it went to sleep
+        if (__atomic_load_n(_sqFlags, __ATOMIC_ACQUIRE) & IORING_SQ_NEED_WAKEUP)
+            flags |= IORING_ENTER_SQ_WAKEUP;
+        else if (!minComplete && !(flags & IORING_ENTER_SQ_WAIT))
+            return 0;
+    }
+    return int(syscall(__NR_io_uring_enter, _ringfd, toSubmit, minComplete, flags, nullptr, 0));
+}
+
+void ReactorUring::setupBuffers()
+{
+    // registering a ring of provided buffers needs linux 5.19. without it sockets are polled
+    _bufRingSz = BufferCount * sizeof(io_uring_buf);
+    auto ring  = mmap(nullptr, _bufRingSz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                      -1, 0);
+    if (ring == MAP_FAILED)
+        return;
+
+    io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr    = reinterpret_cast<std::uint64_t>(ring);
+    reg.ring_entries = BufferCount;
+    reg.bgid         = BufferGroup;
+    if (syscall(__NR_io_uring_register, _ringfd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        Log::syserr("io_uring provided buffers are not available. sockets are polled");
+        munmap(ring, _bufRingSz);
+        return;
+    }
+    _bufRing = static_cast<io_uring_buf_ring *>(ring);
+    _buffers.resize(BufferCount * BufferSz);
+    for (unsigned bid = 0; bid < BufferCount; bid++)
+        provideBuffer(bid);
+    __atomic_store_n(&_bufRing->tail, _bufTail, __ATOMIC_RELEASE);
+    setReceiving(true);
+}
+
+void ReactorUring::provideBuffer(unsigned bid)
+{
+    // the entries overlay the ring header. its bufs member is misplaced in c++, where the empty
+    // struct of __DECLARE_FLEX_ARRAY takes space. the tail is published by the caller
+    auto &buf = reinterpret_cast<io_uring_buf *>(_bufRing)[_bufTail++ & (BufferCount - 1)];
+    buf.addr  = reinterpret_cast<std::uint64_t>(_buffers.data() + bid * BufferSz);
+    buf.len   = BufferSz;
+    buf.bid   = std::uint16_t(bid);
+}
+
+} // namespace TM
@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2020 Sergey Ilinykh <rion4ik@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of mosquitto nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef REACTORURING_H
+#define REACTORURING_H
+
+#include <linux/time_types.h>
+#include <vector>
+
+#include "reactor_loop.h"
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct io_uring_buf_ring;
+
+namespace TM {
+
+/**
+ * @brief ReactorUring is an io_uring backend: sockets are read by the kernel, the rest is polled.
+ *
+ * Devices with receive interest (connected sockets) get a recv request instead of a poll. The
+ * kernel picks a buffer of the ring registered at start (provided buffers), and the data comes
+ * with the completion, so reading it costs no syscall. Writability and other descriptors are
+ * watched with poll requests. All the (re)arms and interest changes made during a loop iteration
+ * are submitted together with the wait in one io_uring_enter call, so there are no per-fd
+ * syscalls at all. With SQPOLL the kernel thread picks submissions up and the loop enters the
+ * kernel only to sleep. Throws ReactorException if the kernel doesn't support io_uring.
+ */
+class ReactorUring : public ReactorLoop {
+public:
+    ReactorUring(bool sqpoll = false);
+    ~ReactorUring();
+
+protected:
+    bool addFd(int fd, std::uint64_t token, std::uint32_t events);
+    bool modifyFd(int fd, std::uint64_t token, std::uint32_t events);
+    void removeFd(int fd);
+    int  wait(Event *events, int maxEvents, int timeout);
+
+private:
+    struct FdState {
+        std::uint64_t token;
+        std::uint32_t events;
+        std::uint32_t seq;        // distinguishes the current poll request from cancelled ones
+        std::uint32_t recvSeq;    // the same for the recv request
+        bool          armed;      // poll request is in flight
+        bool          recvArmed;  // recv request is in flight
+        bool          registered; // addFd was called and removeFd wasn't
+    };
+    static const unsigned      Entries     = 256;
+    static const std::uint64_t TimeoutData = UINT64_MAX;
+    static const std::uint64_t RemoveData  = UINT64_MAX - 1;
+    // provided buffers. a recv completion holds one till the next wait()
+    static const unsigned    BufferCount = 64;
+    static const std::size_t BufferSz    = 16384;
+    static const unsigned    BufferGroup = 0;
+
+    io_uring_sqe *nextSqe();
+    bool          arm(int fd, FdState &state);
+    bool          armRecv(int fd, FdState &state);
+    void          disarm(int fd, FdState &state);
+    void          cancelRecv(int fd, FdState &state);
+    int           enter(unsigned toSubmit, unsigned minComplete, unsigned flags);
+    void          setupBuffers();
+    void          provideBuffer(unsigned bid);
+    void          release();
+
+    int  _ringfd = -1;
+    bool _sqpoll = false;
+
+    void *      _sqRing   = nullptr;
+    std::size_t _sqRingSz = 0;
+    void *      _cqRing   = nullptr;
+    std::size_t _cqRingSz = 0;
+    void *      _sqesMem  = nullptr;
+    std::size_t _sqesSz   = 0;
+
+    unsigned *    _sqHead;
+    unsigned *    _sqTail;
+    unsigned *    _sqFlags;
+    unsigned *    _sqArray;
+    unsigned      _sqMask;
+    unsigned      _sqEntries;
+    io_uring_sqe *_sqes;
+    unsigned *    _cqHead;
+    unsigned *    _cqTail;
+    unsigned      _cqMask;
+    io_uring_cqe *_cqes;
+
+    io_uring_buf_ring *    _bufRing   = nullptr;
+    std::size_t            _bufRingSz = 0;
+    std::vector<std::byte> _buffers;
+    std::vector<unsigned>  _usedBuffers; // handed out by the last wait()
+    unsigned short         _bufTail = 0;
+
+    unsigned             _toSubmit = 0;
+    std::uint32_t        _seq      = 0;
+    std::vector<FdState> _fds; // indexed by fd
+    std::vector<int>     _rearm;
+    __kernel_timespec    _timeout;
+};
+
+} // namespace TM
+
+#endif // REACTORURING_H
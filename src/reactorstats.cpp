@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) 2020 Sergey Ilinykh <rion4ik@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of mosquitto nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <ostream>
+
+#include "device.h"
+#include "reactorstats.h"
+
+namespace TM {
+
+static int log2Bucket(std::uint64_t value, int buckets)
+{
+    int bucket = 0;
+    while (value && bucket < buckets - 1) {
+        value >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+void ReactorStats::merge(const ReactorStats &other)
+{
+    enabled |= other.enabled;
+    iterations += other.iterations;
+    events += other.events;
+    blocked += other.blocked;
+    busy += other.busy;
+    for (int i = 0; i < WakeupBuckets; i++)
+        eventsPerWakeup[i] += other.eventsPerWakeup[i];
+    for (int i = 0; i < CallbackBuckets; i++)
+        callbackTime[i] += other.callbackTime[i];
+    slowest.insert(slowest.end(), other.slowest.begin(), other.slowest.end());
+    std::sort(slowest.begin(), slowest.end(),
+              [](auto const &a, auto const &b) { return a.maxCallback > b.maxCallback; });
+    if (slowest.size() > std::size_t(MaxSlowest))
+        slowest.resize(MaxSlowest);
+}
+
+std::ostream &operator<<(std::ostream &os, const ReactorStats &stats)
+{
+    using namespace std::chrono;
+    if (!stats.enabled)
+        return os << "reactor stats are disabled\n";
+
+    os << "iterations: " << stats.iterations << " events: " << stats.events
+       << " blocked: " << duration_cast<microseconds>(stats.blocked).count() << "us"
+       << " busy: " << duration_cast<microseconds>(stats.busy).count() << "us\n";
+    os << "events per wakeup:";
+    for (int i = 0; i < ReactorStats::WakeupBuckets; i++)
+        if (stats.eventsPerWakeup[i])
+            os << " [" << (i ? 1 << (i - 1) : 0) << "+]=" << stats.eventsPerWakeup[i];
+    os << "\ncallback time:";
+    for (int i = 0; i < ReactorStats::CallbackBuckets; i++)
+        if (stats.callbackTime[i])
+            os << " [" << (i ? 1 << (i - 1) : 0) << "us+]=" << stats.callbackTime[i];
+    os << "\nslowest devices:\n";
+    for (auto const &d : stats.slowest)
+        os << "  " << d.description << " " << duration_cast<microseconds>(d.maxCallback).count()
+           << "us\n";
+    return os;
+}
+
+#ifdef TM_REACTOR_STATS
+
+void ReactorStatsRecorder::wakeup(int events, Clock::duration blocked, Clock::duration busy)
+{
+    bump(_iterations);
+    bump(_events, std::uint64_t(events));
+    bump(_blockedNs, std::uint64_t(std::chrono::nanoseconds(blocked).count()));
+    bump(_busyNs, std::uint64_t(std::chrono::nanoseconds(busy).count()));
+    bump(_eventsPerWakeup[log2Bucket(std::uint64_t(events), ReactorStats::WakeupBuckets)]);
+}
+
+void ReactorStatsRecorder::callback(const Device &dev, std::uint64_t token, Clock::duration spent)
+{
+    auto ns = std::uint64_t(std::chrono::nanoseconds(spent).count());
+    bump(_callbackTime[log2Bucket(ns / 1000, ReactorStats::CallbackBuckets)]);
+    if (ns <= _slowThresholdNs.load(std::memory_order_relaxed))
+        return;
+
+    std::lock_guard<std::mutex> lock(_slowMutex);
+    auto it = std::find_if(_slowest.begin(), _slowest.end(),
+                           [&](auto const &s) { return s.device == &dev && s.token == token; });
+    if (it != _slowest.end()) {
+        it->maxCallback = std::max(it->maxCallback, std::chrono::nanoseconds(ns));
+    } else {
+        // description is built only for the devices which get into the table
+        Slow slow { &dev, token, dev.description(), std::chrono::nanoseconds(ns) };
+        if (_slowest.size() < std::size_t(ReactorStats::MaxSlowest))
+            _slowest.push_back(std::move(slow));
+        else
+            _slowest.back() = std::move(slow);
+    }
+    std::sort(_slowest.begin(), _slowest.end(),
+              [](auto const &a, auto const &b) { return a.maxCallback > b.maxCallback; });
+    if (_slowest.size() == std::size_t(ReactorStats::MaxSlowest))
+        _slowThresholdNs = std::uint64_t(_slowest.back().maxCallback.count());
+}
+
+ReactorStats ReactorStatsRecorder::snapshot() const
+{
+    ReactorStats stats;
+    stats.enabled    = enabled();
+    stats.iterations = _iterations.load(std::memory_order_relaxed);
+    stats.events     = _events.load(std::memory_order_relaxed);
+    stats.blocked    = std::chrono::nanoseconds(_blockedNs.load(std::memory_order_relaxed));
+    stats.busy       = std::chrono::nanoseconds(_busyNs.load(std::memory_order_relaxed));
+    for (int i = 0; i < ReactorStats::WakeupBuckets; i++)
+        stats.eventsPerWakeup[i] = _eventsPerWakeup[i].load(std::memory_order_relaxed);
+    for (int i = 0; i < ReactorStats::CallbackBuckets; i++)
+        stats.callbackTime[i] = _callbackTime[i].load(std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> lock(_slowMutex);
+    for (auto const &s : _slowest)
+        stats.slowest.push_back({ s.description, s.maxCallback });
+    return stats;
+}
+
+#endif
+
+} // namespace TM
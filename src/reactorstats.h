@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2020 Sergey Ilinykh <rion4ik@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of mosquitto nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef REACTORSTATS_H
+#define REACTORSTATS_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iosfwd>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace TM {
+
+class Device;
+
+/**
+ * @brief ReactorStats is a snapshot of the event loop instrumentation.
+ *
+ * Histograms use power of two buckets. For eventsPerWakeup bucket i holds wakeups with
+ * [2^(i-1), 2^i) events (bucket 0 is for timeouts). For callbackTime bucket i holds callbacks
+ * which took [2^(i-1), 2^i) microseconds (bucket 0 is for less than 1us). The last bucket of
+ * each histogram takes everything above.
+ */
+struct ReactorStats {
+    static constexpr int WakeupBuckets   = 8;
+    static constexpr int CallbackBuckets = 24;
+    static constexpr int MaxSlowest      = 8;
+
+    struct SlowDevice {
+        std::string              description;
+        std::chrono::nanoseconds maxCallback;
+    };
+
+    bool                                       enabled    = false;
+    std::uint64_t                              iterations = 0;
+    std::uint64_t                              events     = 0;
+    std::chrono::nanoseconds                   blocked { 0 };
+    std::chrono::nanoseconds                   busy { 0 };
+    std::array<std::uint64_t, WakeupBuckets>   eventsPerWakeup {};
+    std::array<std::uint64_t, CallbackBuckets> callbackTime {};
+    std::vector<SlowDevice>                    slowest; // the slowest first
+
+    void merge(const ReactorStats &other);
+};
+
+std::ostream &operator<<(std::ostream &os, const ReactorStats &stats);
+
+#ifdef TM_REACTOR_STATS
+
+/**
+ * @brief ReactorStatsRecorder collects ReactorStats on the loop thread.
+ *
+ * Counters have a single writer, so they are updated with relaxed load/store pairs which are
+ * plain moves on common platforms. snapshot() may be called from any thread.
+ */
+class ReactorStatsRecorder {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    bool enabled() const { return _enabled.load(std::memory_order_relaxed); }
+    void setEnabled(bool enabled) { _enabled = enabled; }
+
+    Clock::time_point now() const { return enabled() ? Clock::now() : Clock::time_point(); }
+
+    void wakeup(int events, Clock::duration blocked, Clock::duration busy);
+    void callback(const Device &dev, std::uint64_t token, Clock::duration spent);
+
+    ReactorStats snapshot() const;
+
+private:
+    struct Slow {
+        const Device *           device;
+        std::uint64_t            token; // distinguishes devices reusing the same address
+        std::string              description;
+        std::chrono::nanoseconds maxCallback;
+    };
+
+    static void bump(std::atomic<std::uint64_t> &counter, std::uint64_t value = 1)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    std::atomic<bool>          _enabled { false };
+    std::atomic<std::uint64_t> _iterations { 0 };
+    std::atomic<std::uint64_t> _events { 0 };
+    std::atomic<std::uint64_t> _blockedNs { 0 };
+    std::atomic<std::uint64_t> _busyNs { 0 };
+    std::atomic<std::uint64_t> _eventsPerWakeup[ReactorStats::WakeupBuckets] = {};
+    std::atomic<std::uint64_t> _callbackTime[ReactorStats::CallbackBuckets]  = {};
+    std::atomic<std::uint64_t> _slowThresholdNs { 0 }; // fast check before taking the mutex
+    mutable std::mutex         _slowMutex;
+    std::vector<Slow>          _slowest;
+};
+
+#else
+
+// everything is optimized out
+class ReactorStatsRecorder {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    constexpr bool    enabled() const { return false; }
+    void              setEnabled(bool) { }
+    Clock::time_point now() const { return Clock::time_point(); }
+    void              wakeup(int, Clock::duration, Clock::duration) { }
+    void              callback(const Device &, std::uint64_t, Clock::duration) { }
+    ReactorStats      snapshot() const { return ReactorStats(); }
+};
+
+#endif
+
+} // namespace TM
+
+#endif // REACTORSTATS_H
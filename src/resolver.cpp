@@ -0,0 +1,197 @@
+/*
+ * Copyright (c) 2020 Sergey Ilinykh <rion4ik@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of mosquitto nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cstring>
+#include <netdb.h>
+
+#include "log.h"
+#include "reactor.h"
+#include "resolver.h"
+
+namespace TM {
+
+static const std::chrono::seconds UnknownTtl(-1);
+
+Resolver::Resolver(std::size_t threads, Lookup lookup) :
+    _lookup(lookup ? std::move(lookup) : Lookup(systemLookup)),
+    _maxThreads(std::max<std::size_t>(threads, 1))
+{
+}
+
+Resolver::~Resolver()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _cond.notify_all();
+    for (auto &t : _threads)
+        t.join();
+}
+
+Resolver &Resolver::instance()
+{
+    static Resolver resolver;
+    return resolver;
+}
+
+void Resolver::resolve(const std::shared_ptr<Reactor> &reactor, const std::string &host,
+                       Callback callback)
+{
+    Addresses addresses;
+    if (parseNumeric(host, addresses)) {
+        callback(addresses);
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    auto                         it = _cache.find(host);
+    if (it != _cache.end()) {
+        if (it->second.expires > Clock::now()) {
+            addresses = it->second.addresses;
+            lock.unlock();
+            callback(addresses);
+            return;
+        }
+        _cache.erase(it);
+    }
+
+    auto &waiters = _pending[host];
+    waiters.push_back(Waiter { reactor, std::move(callback) });
+    if (waiters.size() > 1)
+        return; // the lookup is already in progress
+    _queue.push_back(host);
+    if (_idle)
+        _cond.notify_one();
+    else if (_threads.size() < _maxThreads)
+        _threads.emplace_back([this]() { worker(); });
+}
+
+void Resolver::setTtl(std::chrono::seconds positive, std::chrono::seconds negative)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _ttl         = positive;
+    _negativeTtl = negative;
+}
+
+void Resolver::clearCache()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _cache.clear();
+}
+
+void Resolver::pin(const std::string &host, Addresses addresses)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _cache[host] = Entry { std::move(addresses), Clock::time_point::max() };
+}
+
+void Resolver::worker()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true) {
+        _idle++;
+        _cond.wait(lock, [this]() { return _stopping || !_queue.empty(); });
+        _idle--;
+        if (_stopping)
+            return;
+        auto host = std::move(_queue.front());
+        _queue.pop_front();
+
+        lock.unlock();
+        auto ttl       = UnknownTtl;
+        auto addresses = _lookup(host, ttl);
+        finish(host, std::move(addresses), ttl);
+        lock.lock();
+    }
+}
+
+void Resolver::finish(const std::string &host, Addresses &&addresses, std::chrono::seconds ttl)
+{
+    std::vector<Waiter> waiters;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (addresses.empty())
+            ttl = _negativeTtl;
+        else if (ttl == UnknownTtl || ttl > _ttl)
+            ttl = _ttl;
+        if (ttl.count() > 0)
+            _cache[host] = Entry { addresses, Clock::now() + ttl };
+        auto it = _pending.find(host);
+        waiters = std::move(it->second);
+        _pending.erase(it);
+    }
+    if (addresses.empty())
+        Log("dns resolve failed for ") << host;
+    for (auto &w : waiters)
+        w.reactor->post([callback = std::move(w.callback), addresses]() { callback(addresses); });
+}
+
+Resolver::Addresses Resolver::systemLookup(const std::string &host, std::chrono::seconds &)
+{
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags    = AI_ADDRCONFIG; // no ipv6 addresses without ipv6 connectivity
+    hints.ai_protocol = IPPROTO_TCP;
+
+    Addresses addresses;
+    addrinfo *result;
+    if (getaddrinfo(host.c_str(), nullptr, &hints, &result) != 0)
+        return addresses;
+    for (auto ai = result; ai; ai = ai->ai_next) {
+        sockaddr_storage addr;
+        memset(&addr, 0, sizeof(addr));
+        memcpy(&addr, ai->ai_addr, ai->ai_addrlen);
+        addresses.push_back(addr);
+    }
+    freeaddrinfo(result);
+    return addresses;
+}
+
+bool Resolver::parseNumeric(const std::string &host, Addresses &addresses)
+{
+    sockaddr_storage addr;
+    memset(&addr, 0, sizeof(addr));
+    auto sin  = reinterpret_cast<sockaddr_in *>(&addr);
+    auto sin6 = reinterpret_cast<sockaddr_in6 *>(&addr);
+    if (inet_pton(AF_INET, host.c_str(), &sin->sin_addr) == 1)
+        sin->sin_family = AF_INET;
+    else if (inet_pton(AF_INET6, host.c_str(), &sin6->sin6_addr) == 1)
+        sin6->sin6_family = AF_INET6;
+    else
+        return false;
+    addresses.push_back(addr);
+    return true;
+}
+
+} // namespace TM
@@ -0,0 +1,118 @@
+/*
+ * Copyright (c) 2020 Sergey Ilinykh <rion4ik@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of mosquitto nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef RESOLVER_H
+#define RESOLVER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <vector>
+
+namespace TM {
+
+class Reactor;
+
+/**
+ * @brief Resolver looks up host names on worker threads and caches the results.
+ *
+ * Lookups never block the reactor: the blocking resolver runs on a small thread pool and the
+ * result is posted back to the requesting reactor. Concurrent requests for the same host are
+ * coalesced into one lookup, and answers (including failures) are cached for a while (see setTtl),
+ * so repeat connections to the same hosts skip DNS completely.
+ */
+class Resolver {
+public:
+    using Addresses = std::vector<sockaddr_storage>;
+    // empty addresses mean the lookup failed
+    using Callback = std::function<void(const Addresses &)>;
+    // blocking lookup. returns the addresses and sets ttl if the source knows it
+    using Lookup = std::function<Addresses(const std::string &host, std::chrono::seconds &ttl)>;
+
+    Resolver(std::size_t threads = 2, Lookup lookup = Lookup());
+    ~Resolver();
+
+    // the instance used by sockets
+    static Resolver &instance();
+
+    // the callback is called on the reactor's thread. numeric addresses and cache hits are
+    // answered synchronously, before resolve() returns
+    void resolve(const std::shared_ptr<Reactor> &reactor, const std::string &host,
+                 Callback callback);
+
+    // answers are kept for the record TTL reported by the lookup, capped by the positive ttl.
+    // getaddrinfo doesn't report TTLs, so the system lookup makes it a fixed-lifetime cache: its
+    // answers are kept for the positive ttl, which is short by default to follow dns changes
+    void setTtl(std::chrono::seconds positive, std::chrono::seconds negative);
+    void clearCache();
+    // the host always resolves to the addresses, like an /etc/hosts entry. cleared by clearCache
+    void pin(const std::string &host, Addresses addresses);
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Entry {
+        Addresses         addresses;
+        Clock::time_point expires;
+    };
+    struct Waiter {
+        std::shared_ptr<Reactor> reactor;
+        Callback                 callback;
+    };
+
+    static Addresses systemLookup(const std::string &host, std::chrono::seconds &ttl);
+    static bool      parseNumeric(const std::string &host, Addresses &addresses);
+
+    void worker();
+    void finish(const std::string &host, Addresses &&addresses, std::chrono::seconds ttl);
+
+    Lookup                                     _lookup;
+    std::size_t                                _maxThreads;
+    std::chrono::seconds                       _ttl { 10 };
+    std::chrono::seconds                       _negativeTtl { 5 };
+    std::mutex                                 _mutex;
+    std::condition_variable                    _cond;
+    bool                                       _stopping = false;
+    std::size_t                                _idle     = 0; // threads waiting for work
+    std::map<std::string, Entry>               _cache;
+    std::map<std::string, std::vector<Waiter>> _pending; // lookups in progress or queued
+    std::deque<std::string>                    _queue;
+    std::vector<std::thread>                   _threads; // started on demand
+};
+
+} // namespace TM
+
+#endif // RESOLVER_H
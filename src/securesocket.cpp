@@ -27,27 +27,30 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
-#include <deque>
+#include <algorithm>
+#include <climits>
+#include <sys/uio.h>
+#include <unistd.h>
 
 #include <openssl/err.h>
 #include <openssl/ssl.h>
 
 #include "log.h"
 #include "securesocket.h"
+#include "tlscontext.h"
+#include "tlsengine.h"
+#include "workerpool.h"
 
 namespace TM {
 
-static bool sslInitialized = false;
-
-static void sslInit()
-{
-    if (sslInitialized)
-        return;
-    SSL_library_init();
-    SSLeay_add_ssl_algorithms();
-    SSL_load_error_strings();
-    sslInitialized = true;
-}
+// plaintext carried by one TLS record
+static const std::size_t MaxRecordSz = 16384;
+// records collected by readTo before writing them out
+static const std::size_t ReadToBufSz = 16 * MaxRecordSz;
+// ciphertext taken from the socket at once
+static const std::size_t CipherReadSz = 4 * MaxRecordSz;
+// gather limit of sending ciphertext
+static const int MaxCipherIov = 16;
 
 static void SSL_trace(int write_p, int version, int content_type, const void *buf, size_t len,
                       SSL *ssl, void *arg)
@@ -72,72 +75,404 @@ static void logSsl()
 }
 
 struct SecureSocket::Private {
-    SSL *                              ssl = nullptr;
-    std::deque<std::vector<std::byte>> buffer;
+    std::shared_ptr<TlsEngine>            engine;
+    SSL *                                 ssl           = nullptr; // owned by the engine
+    bool                                  offloaded     = false; // a handshake step on a worker
+    BufferChain                           staged;                // input which came meanwhile
+    bool                                  handshaking   = false;
+    bool                                  kernelSend    = false;
+    bool                                  kernelRecv    = false;
+    std::string                           earlyData;
+    std::size_t                           earlyWritten  = 0;
+    bool                                  writingEarly  = false; // the session allows 0-rtt
+    bool                                  earlyAccepted = false;
+    std::chrono::steady_clock::time_point handshakeStarted;
+    std::chrono::microseconds             handshakeTime { 0 };
+    std::shared_ptr<TlsContext>           context;
+    std::string                           record; // small writes packed into one record
+    std::vector<std::byte>                readToBuffer;
 };
 
-SecureSocket::SecureSocket() : d(new Private) { sslInit(); }
+SecureSocket::SecureSocket() : d(new Private) { }
+
+SecureSocket::~SecureSocket() { }
 
-SecureSocket::~SecureSocket()
+void SecureSocket::setTlsContext(std::shared_ptr<TlsContext> context)
 {
-    if (d->ssl)
-        SSL_free(d->ssl);
+    d->context = std::move(context);
 }
 
-void SecureSocket::on_connected()
-{
-    const SSL_METHOD *method = TLS_client_method();
-    SSL_CTX *         ctx;
+std::shared_ptr<TlsContext> SecureSocket::tlsContext() const { return d->context; }
+
+bool SecureSocket::sessionResumed() const { return d->ssl && SSL_session_reused(d->ssl); }
+
+bool SecureSocket::handshaking() const { return d->handshaking; }
+
+std::chrono::microseconds SecureSocket::handshakeTime() const { return d->handshakeTime; }
 
-    if (!(method = TLS_client_method()) || !(ctx = SSL_CTX_new(method))
-        || !(d->ssl = SSL_new(ctx))) {
+bool SecureSocket::kernelTlsSend() const { return d->kernelSend; }
 
-        Log("SSL context init error");
+bool SecureSocket::kernelTlsReceive() const { return d->kernelRecv; }
+
+void SecureSocket::setEarlyData(std::string data) { d->earlyData = std::move(data); }
+
+bool SecureSocket::earlyDataAccepted() const { return d->earlyAccepted; }
+
+void SecureSocket::on_connected()
+{
+    if (!d->context)
+        d->context = TlsContext::defaultContext();
+    d->engine.reset(); // of the previous connection
+    d->ssl       = nullptr;
+    d->offloaded = false;
+    d->staged.clear();
+    auto ssl = SSL_new(d->context->handle());
+    if (!ssl) {
+        Log("SSL init error");
         logSsl();
         on_disconnect();
         return;
     }
-    SSL_set_tlsext_host_name(d->ssl, remoteHostname().c_str());
+    // ciphertext goes through our buffers, unless kTLS is wanted. openssl enables it only on
+    // its own socket bio
+    if (d->context->config().kernelTls)
+        d->engine = std::make_shared<TlsEngine>(ssl, fd);
+    else
+        d->engine = std::make_shared<TlsEngine>(ssl);
+    // the reactor can't read the socket for openssl
+    setReceivable(d->engine->buffered());
+    d->ssl = ssl;
+    d->context->prepare(d->ssl, remoteHostname(), remotePort());
+    auto session     = SSL_get0_session(d->ssl);
+    d->writingEarly  = !d->earlyData.empty() && session
+        && SSL_SESSION_get_max_early_data(session) >= d->earlyData.size();
+    d->earlyWritten  = 0;
+    d->earlyAccepted = false;
+    // a write may take a part of the output queue, and its retry comes from wherever the queue
+    // keeps the same bytes then
+    SSL_set_mode(d->ssl, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
 
     SSL_set_msg_callback(d->ssl, SSL_trace);
 
-    SSL_set_fd(d->ssl, fd);
-    if (SSL_connect(d->ssl) <= 0) {
+    SSL_set_connect_state(d->ssl);
+    d->handshaking      = true;
+    d->kernelSend       = false;
+    d->kernelRecv       = false;
+    d->handshakeStarted = std::chrono::steady_clock::now();
+    d->handshakeTime    = std::chrono::microseconds(0);
+    continueHandshake();
+}
+
+// one step of the handshake as far as the buffered input allows, early data (if any) goes
+// right after the client hello. returns SSL_ERROR_NONE once it's done. touches nothing but the
+// ssl object and its bio, so it may run on a worker thread
+static int handshakeStep(SSL *ssl, std::string_view early, std::size_t &written)
+{
+    int ret = 1;
+    while (ret > 0 && written < early.size()) {
+        std::size_t len = 0;
+        ret = SSL_write_early_data(ssl, early.data() + written, early.size() - written, &len);
+        written += len;
+    }
+    if (ret > 0)
+        ret = SSL_do_handshake(ssl);
+    if (ret > 0)
+        return SSL_ERROR_NONE;
+    int err = SSL_get_error(ssl, ret);
+    if (err != SSL_ERROR_WANT_READ && err != SSL_ERROR_WANT_WRITE)
+        logSsl(); // the error queue is per thread
+    return err;
+}
+
+void SecureSocket::continueHandshake()
+{
+    auto const &workers = d->context->config().handshakeWorkers;
+    if (workers && d->engine->buffered() && offloadHandshake(*workers))
+        return;
+
+    // each step goes as far as the data at hand allows, the next one is run by the reactor
+    int err;
+    for (;;) {
+        std::string_view early;
+        if (d->writingEarly)
+            early = d->earlyData;
+        err = handshakeStep(d->ssl, early, d->earlyWritten);
+        if (!flushOutput())
+            err = SSL_ERROR_SYSCALL;
+        else if (err == SSL_ERROR_WANT_READ && fillInput())
+            continue;
+        break;
+    }
+    handshakeProgress(err);
+}
+
+bool SecureSocket::offloadHandshake(WorkerPool &workers)
+{
+    if (d->offloaded) {
+        // the engine is busy. the input waits aside, so level-triggered readiness doesn't spin
+        auto space = d->staged.prepare(CipherReadSz);
+        auto len   = Socket::readInto(reinterpret_cast<std::byte *>(space.data()), space.size());
+        d->staged.commit(len);
+        return true;
+    }
+    d->engine->input().append(d->staged);
+    d->staged.clear();
+    fillInput();
+
+    struct Step {
+        std::string early;
+        std::size_t earlyWritten = 0;
+        int         err          = SSL_ERROR_NONE;
+    };
+    auto step = std::make_shared<Step>();
+    if (d->writingEarly)
+        step->early = d->earlyData.substr(d->earlyWritten);
+
+    // the job keeps the engine alive, the socket may disconnect and reconnect meanwhile
+    auto engine = d->engine;
+    auto self   = std::static_pointer_cast<SecureSocket>(shared_from_this());
+    auto job = [engine, step]() {
+        step->err = handshakeStep(engine->handle(), step->early, step->earlyWritten);
+    };
+    auto done = [self, engine, step]() {
+        auto priv = self->d.get();
+        if (engine != priv->engine)
+            return; // the connection is gone
+        priv->offloaded = false;
+        priv->earlyWritten += step->earlyWritten;
+        int err = step->err;
+        if (!self->flushOutput()) {
+            err = SSL_ERROR_SYSCALL;
+        } else if (err == SSL_ERROR_WANT_READ
+                   && (!priv->staged.empty() || self->Socket::bytesAvailable())) {
+            self->continueHandshake(); // more came while the worker was busy
+            return;
+        }
+        self->handshakeProgress(err);
+    };
+    d->offloaded = workers.submit(_reactor, std::move(job), std::move(done));
+    return d->offloaded;
+}
+
+void SecureSocket::handshakeProgress(int err)
+{
+    if ((err == SSL_ERROR_WANT_READ && !_atEnd) || err == SSL_ERROR_WANT_WRITE) {
+        setWriteInterest(err == SSL_ERROR_WANT_WRITE); // readability is watched anyway
+        return;
+    }
+    if (err != SSL_ERROR_NONE) {
         Log("SSL connection failure");
-        logSsl();
+        d->handshaking = false;
         on_disconnect();
         return;
     }
+
+    d->handshaking   = false;
+    d->handshakeTime = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - d->handshakeStarted);
+    setWriteInterest(false);
+    if (d->writingEarly) {
+        // rejected early data is dropped by the server, it has to be written again
+        d->writingEarly  = false;
+        d->earlyAccepted = SSL_get_early_data_status(d->ssl) == SSL_EARLY_DATA_ACCEPTED;
+        Log("SSL early data ") << (d->earlyAccepted ? "accepted" : "rejected");
+    }
+#ifndef OPENSSL_NO_KTLS
+    d->kernelSend = BIO_get_ktls_send(SSL_get_wbio(d->ssl));
+    d->kernelRecv = BIO_get_ktls_recv(SSL_get_rbio(d->ssl));
+#endif
+    Log("SSL handshake with ") << remoteHostname() << " took " << d->handshakeTime.count()
+                               << "us" << (SSL_session_reused(d->ssl) ? " (resumed)" : "")
+                               << (d->kernelSend ? " ktls-tx" : "")
+                               << (d->kernelRecv ? " ktls-rx" : "");
     Socket::on_connected();
 }
 
-std::size_t SecureSocket::writeData(const char *data, std::size_t size)
+void SecureSocket::on_readyRead()
+{
+    if (d->handshaking)
+        continueHandshake();
+    else
+        Socket::on_readyRead();
+}
+
+void SecureSocket::on_readyWrite()
+{
+    if (d->handshaking)
+        continueHandshake();
+    else
+        Socket::on_readyWrite();
+}
+
+void SecureSocket::disconnect()
+{
+    if (d->offloaded) {
+        // a worker still runs the handshake step. the engine is left to it
+        d->engine.reset();
+        d->ssl       = nullptr;
+        d->offloaded = false;
+    }
+    // openssl drops the session of a connection freed without shutdown, so it couldn't be
+    // resumed. no close_notify is actually sent, the peer may be gone already
+    if (d->ssl && SSL_is_init_finished(d->ssl))
+        SSL_set_shutdown(d->ssl, SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+    d->handshaking = false;
+    d->staged.clear();
+    if (d->engine) {
+        d->engine->input().clear();
+        d->engine->output().clear();
+    }
+    Socket::disconnect();
+}
+
+bool SecureSocket::fillInput()
 {
-    int len = SSL_write(d->ssl, data, int(size));
-    if (len < 0) {
+    if (!d->engine || !d->engine->buffered() || fd == -1)
+        return false;
+    // one read may bring many records. they are consumed right from the buffer it went to
+    auto &input = d->engine->input();
+    auto  space = input.prepare(CipherReadSz);
+    auto  len   = Socket::readInto(reinterpret_cast<std::byte *>(space.data()), space.size());
+    input.commit(len);
+    return len;
+}
+
+bool SecureSocket::flushOutput()
+{
+    if (!d->engine)
+        return true;
+    auto &output = d->engine->output();
+    while (!output.empty() && fd != -1) {
+        iovec       iov[MaxCipherIov];
+        int         count = 0;
+        std::size_t size  = 0;
+        for (auto const &slice : output.slices()) {
+            if (count == MaxCipherIov)
+                break;
+            iov[count].iov_base  = const_cast<char *>(slice.view().data());
+            iov[count++].iov_len = slice.size();
+            size += slice.size();
+        }
+        auto len = Socket::writeData(iov, count);
+        if (len == std::size_t(-1))
+            return false;
+        output.consume(len);
+        if (len < size)
+            break; // the socket is full
+    }
+    // the rest goes when the socket is writable
+    setTransportBacklog(!output.empty());
+    return true;
+}
+
+bool SecureSocket::flushTransport() { return flushOutput(); }
+
+std::size_t SecureSocket::writeData(const iovec *iov, int count)
+{
+    // the kernel frames and encrypts plain writes itself, so the queue goes out with one writev
+    if (d->kernelSend)
+        return Socket::writeData(iov, count);
+
+    // the records made before go first
+    if (!flushOutput())
+        return std::size_t(-1);
+    if (!d->engine->output().empty())
+        return 0;
+
+    // there is no SSL_writev. instead of a record (with its header, mac and syscall) per buffer,
+    // small buffers are copied together up to a full record. a retry after WANT_WRITE gets the
+    // same queue front again, so the packed bytes start the same
+    auto data = static_cast<const char *>(iov[0].iov_base);
+    auto size = iov[0].iov_len;
+    if (count > 1 && size < MaxRecordSz) {
+        d->record.clear();
+        for (int i = 0; i < count && d->record.size() < MaxRecordSz; i++)
+            d->record.append(static_cast<const char *>(iov[i].iov_base),
+                             std::min(iov[i].iov_len, MaxRecordSz - d->record.size()));
+        data = d->record.data();
+        size = d->record.size();
+    }
+
+    int len = SSL_write(d->ssl, data, int(std::min(size, std::size_t(INT_MAX))));
+    if (len <= 0) {
         int err = SSL_get_error(d->ssl, len);
         if (err == SSL_ERROR_WANT_WRITE || err == SSL_ERROR_WANT_READ)
             return 0;
+        Log("failed to write to secure socket");
+        logSsl();
         return std::size_t(-1);
     }
-    return std::size_t(len);
+    // taken by openssl whether or not the socket takes all of its records now
+    return flushOutput() ? std::size_t(len) : std::size_t(-1);
 }
 
-std::vector<std::byte> SecureSocket::readData(std::size_t size)
+std::size_t SecureSocket::bytesAvailable() const
 {
-    std::vector<std::byte> buf(size);
+    // decrypted bytes buffered by openssl plus the raw ones still in the kernel. the latter
+    // include record overhead, so it's an upper bound of what a read may return
+    std::size_t pending = d->ssl ? std::size_t(SSL_pending(d->ssl)) : 0;
+    if (d->engine)
+        pending += d->engine->input().size();
+    return pending + Socket::bytesAvailable();
+}
+
+std::size_t SecureSocket::readTo(int out, std::size_t size)
+{
+    // with kTLS receive SSL_read is a recvmsg of decrypted data. it's not spliced still, since
+    // non-data records (alerts, tickets, key updates) have to go to openssl
+    size = size ? std::min(size, ReadToBufSz) : ReadToBufSz;
+    d->readToBuffer.resize(size);
+
+    // SSL_read gives one record at a time
+    std::size_t len = 0;
+    while (len < size && fd != -1) {
+        auto n = readInto(d->readToBuffer.data() + len, size - len);
+        if (!n)
+            break;
+        len += n;
+    }
+    _moreToRead = len == size;
 
-    int len = SSL_read(d->ssl, buf.data(), int(size));
-    if (len < 0) {
+    for (std::size_t written = 0; written < len;) {
+        auto n = ::write(out, d->readToBuffer.data() + written, len - written);
+        if (n <= 0) {
+            Log::syserr("failed to write output");
+            return std::size_t(-1);
+        }
+        written += std::size_t(n);
+    }
+    return len;
+}
+
+std::size_t SecureSocket::readInto(std::byte *data, std::size_t size)
+{
+    if (!d->ssl)
+        return 0;
+    int len;
+    // more ciphertext is read from the socket only when the buffered one is exhausted
+    while ((len = SSL_read(d->ssl, data, int(std::min(size, std::size_t(INT_MAX))))) <= 0
+           && SSL_get_error(d->ssl, len) == SSL_ERROR_WANT_READ && fillInput())
+        ;
+    if (!flushOutput()) { // e.g. a key update answer
+        Log("failed to write to secure socket");
+        on_disconnect();
+        return 0;
+    }
+    if (len <= 0) {
         int err = SSL_get_error(d->ssl, len);
         if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE)
-            return std::vector<std::byte>();
+            return 0;
+        if (err == SSL_ERROR_ZERO_RETURN) {
+            _atEnd = true;
+            return 0;
+        }
         Log("failed to read from secure socket");
         on_disconnect();
-        return std::vector<std::byte>();
+        return 0;
     }
-    buf.resize(std::size_t(len));
-    return buf;
+    // SSL_read returns at most one record, so only WANT_READ tells the input is exhausted
+    _moreToRead = true;
+    return std::size_t(len);
 }
 
 } // namespace TM
@@ -34,19 +34,63 @@
 
 namespace TM {
 
+class TlsContext;
+class WorkerPool;
+
 class SecureSocket : public TM::Socket
 {
 public:
-    static const int ReadBufSz = 4096;
-
     SecureSocket();
     ~SecureSocket() override;
 
+    // the default one is used unless set before connecting
+    void                        setTlsContext(std::shared_ptr<TlsContext> context);
+    std::shared_ptr<TlsContext> tlsContext() const;
+
+    // the handshake resumed a cached session instead of doing the full key exchange
+    bool sessionResumed() const;
+
+    // the tcp connection is established and the tls handshake is in progress. it's driven by
+    // the reactor's readiness events, the connected callback is called once it's done
+    bool handshaking() const;
+    // how long the last handshake took. zero till it's done
+    std::chrono::microseconds handshakeTime() const;
+
+    // record crypto of the established connection is done by the kernel (see
+    // TlsContext::Config::kernelTls)
+    bool kernelTlsSend() const;
+    bool kernelTlsReceive() const;
+
+    // written along with the handshake (tls 1.3 0-rtt) if the session being resumed allows it,
+    // saving a round trip. early data may be replayed by an attacker, so it's for idempotent
+    // requests only. the connected callback checks earlyDataAccepted() and writes the data
+    // again if it wasn't
+    void setEarlyData(std::string data);
+    bool earlyDataAccepted() const;
+
+    void        disconnect() override;
+    std::size_t bytesAvailable() const override;
+    // decrypted data can't be spliced. it's collected into a large buffer instead, so it's
+    // written with few syscalls
+    std::size_t readTo(int fd, std::size_t size = 0) override;
+
+    void on_readyRead() override;
+    void on_readyWrite() override;
+
 protected:
     void on_connected() override;
-    std::size_t writeData(const char *data, std::size_t size) override;
-    std::vector<std::byte> readData(std::size_t size) override;
+    bool flushTransport() override;
+    std::size_t writeData(const iovec *iov, int count) override;
+    std::size_t readInto(std::byte *data, std::size_t size) override;
 private:
+    void continueHandshake();
+    // false if the pool's queue is full
+    bool offloadHandshake(WorkerPool &workers);
+    void handshakeProgress(int err);
+    // moves ciphertext between the socket and the engine's buffers
+    bool fillInput();
+    bool flushOutput();
+
     struct Private;
     std::unique_ptr<Private> d;
 };
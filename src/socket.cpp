@@ -27,61 +27,282 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
-#include <netdb.h>
+#include <algorithm>
+#include <cerrno>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <utility>
 
 #include "log.h"
 #include "reactor.h"
+#include "reactor_pool.h"
+#include "resolver.h"
 #include "socket.h"
 
 namespace TM {
 
+// RFC 8305 recommends 250ms between the starts of connection attempts
+static const std::chrono::milliseconds ConnectionAttemptDelay(250);
+
+// one of the connection attempts raced against each other
+class ConnectAttempt : public Device {
+public:
+    using Callback = std::function<void(ConnectAttempt &, int error)>;
+
+    ConnectAttempt(int sock, Callback callback) : _callback(std::move(callback))
+    {
+        fd             = sock;
+        _writeInterest = true; // the socket gets writable once connected
+    }
+
+    // hands the connected descriptor over
+    int release() { return std::exchange(fd, -1); }
+
+    // failures are reported as error/hangup, i.e. readability
+    void on_readyRead() override { finish(); }
+    void on_readyWrite() override { finish(); }
+
+private:
+    void finish()
+    {
+        int       err = 0;
+        socklen_t len = sizeof(err);
+        if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1)
+            err = errno;
+        _callback(*this, err);
+    }
+
+    Callback _callback;
+};
+
+static void applyOptions(int sock, const SocketOptions &options)
+{
+    auto set = [sock](int level, int name, int value, const char *what) {
+        if (setsockopt(sock, level, name, &value, sizeof(value)) == -1)
+            Log::syserr("failed to set ") << what;
+    };
+    if (options.noDelay)
+        set(IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+    if (options.quickAck)
+        set(IPPROTO_TCP, TCP_QUICKACK, 1, "TCP_QUICKACK");
+    // buffer sizes have to be set before connect to affect the window scale
+    if (options.receiveBuffer)
+        set(SOL_SOCKET, SO_RCVBUF, options.receiveBuffer, "SO_RCVBUF");
+    if (options.sendBuffer)
+        set(SOL_SOCKET, SO_SNDBUF, options.sendBuffer, "SO_SNDBUF");
+    if (options.userTimeout.count())
+        set(IPPROTO_TCP, TCP_USER_TIMEOUT, int(options.userTimeout.count()), "TCP_USER_TIMEOUT");
+    if (options.fastOpen)
+        set(IPPROTO_TCP, TCP_FASTOPEN_CONNECT, 1, "TCP_FASTOPEN_CONNECT");
+}
+
+// alternates address families starting with the preferred one (RFC 8305 section 4)
+static Resolver::Addresses interleave(const Resolver::Addresses &addresses)
+{
+    Resolver::Addresses preferred, other, result;
+    for (auto const &addr : addresses)
+        (addr.ss_family == addresses.front().ss_family ? preferred : other).push_back(addr);
+    for (std::size_t i = 0; i < std::max(preferred.size(), other.size()); i++) {
+        if (i < preferred.size())
+            result.push_back(preferred[i]);
+        if (i < other.size())
+            result.push_back(other[i]);
+    }
+    return result;
+}
+
 struct Socket::Private {
+    enum State : std::uint8_t { Unconnected, Resolving, Connecting, Connected };
+
     std::string      host;
     std::uint16_t    port;
-    sockaddr_in      addr;
     Socket::Callback readyReadCB;
     Socket::Callback readyWriteCB;
     Socket::Callback connectedCB;
     Socket::Callback disconnectedCallback;
+    SocketOptions    options;
+    Connector        connector;
+
+    std::chrono::milliseconds idleTimeout { 0 };
+    std::chrono::milliseconds lastActivity { 0 };
+    Reactor::TimerId          idleTimer = Reactor::InvalidTimer;
 
-    bool resolveHost();
+    State           state         = Unconnected;
+    std::uint32_t   attempt       = 0; // bumped by connect/disconnect so stale lookups are ignored
+    ConnectAwaiter *connectWaiter = nullptr;
+    ReadAwaiter *   readWaiter    = nullptr;
+
+    // happy eyeballs
+    Resolver::Addresses                          candidates;
+    std::size_t                                  nextCandidate = 0;
+    std::vector<std::shared_ptr<ConnectAttempt>> attempts;
+    Reactor::TimerId                             attemptTimer = Reactor::InvalidTimer;
+
+    void connectTo(Socket *s, const Resolver::Addresses &addresses);
+    void startAttempt(Socket *s);
+    void attemptFinished(Socket *s, ConnectAttempt &attempt, int error);
+    void cancelAttempts(Socket *s);
+    void startIdleTimer(Socket *s, std::chrono::milliseconds timeout);
+    void stopIdleTimer(Socket *s);
 };
 
-bool Socket::Private::resolveHost()
+void Socket::Private::connectTo(Socket *s, const Resolver::Addresses &addresses)
 {
-    addrinfo hints;
-    memset(&hints, 0, sizeof(hints));
-    hints.ai_family   = AF_INET;
-    hints.ai_socktype = SOCK_STREAM;
-    hints.ai_flags    = 0;
-    hints.ai_protocol = IPPROTO_TCP;
+    if (addresses.empty()) {
+        s->on_disconnect();
+        return;
+    }
+    candidates    = interleave(addresses);
+    nextCandidate = 0;
+    state         = Connecting;
+    startAttempt(s);
+}
 
-    addrinfo *result;
+void Socket::Private::startAttempt(Socket *s)
+{
+    if (attemptTimer != Reactor::InvalidTimer) {
+        s->_reactor->cancelTimer(attemptTimer);
+        attemptTimer = Reactor::InvalidTimer;
+    }
+    std::weak_ptr<Device> weakSelf = s->shared_from_this();
+    while (nextCandidate < candidates.size()) {
+        auto      addr = candidates[nextCandidate++];
+        socklen_t len  = sizeof(sockaddr_in);
+        if (addr.ss_family == AF_INET6) {
+            reinterpret_cast<sockaddr_in6 *>(&addr)->sin6_port = htons(port);
+            len                                                = sizeof(sockaddr_in6);
+        } else {
+            reinterpret_cast<sockaddr_in *>(&addr)->sin_port = htons(port);
+        }
+
+        int sock = socket(addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP);
+        if (sock == -1) {
+            Log::syserr("failed to create socket");
+            continue;
+        }
+        applyOptions(sock, options);
+        if (::connect(sock, reinterpret_cast<sockaddr *>(&addr), len) == -1
+            && errno != EINPROGRESS) {
+            Log::syserr("Error connecting to server");
+            close(sock);
+            continue;
+        }
+
+        // even an immediate success is reported from the reactor, so connect() never calls back
+        auto onFinished = [weakSelf](ConnectAttempt &a, int error) {
+            auto self = weakSelf.lock();
+            if (!self) {
+                a.reactor()->removeDevice(a.shared_from_this());
+                return;
+            }
+            auto sock = static_cast<Socket *>(self.get());
+            sock->d->attemptFinished(sock, a, error);
+        };
+        auto attempt = std::make_shared<ConnectAttempt>(sock, std::move(onFinished));
+        attempt->setReactor(s->_reactor);
+        attempts.push_back(attempt);
+        s->_reactor->addDevice(attempt);
+
+        // the next address gets its chance unless this one connects quickly
+        if (nextCandidate < candidates.size())
+            attemptTimer = s->_reactor->addTimer(ConnectionAttemptDelay, [this, weakSelf]() {
+                auto self = weakSelf.lock();
+                if (!self)
+                    return;
+                attemptTimer = Reactor::InvalidTimer;
+                startAttempt(static_cast<Socket *>(self.get()));
+            });
+        return;
+    }
+    if (attempts.empty())
+        s->on_disconnect(); // every address failed
+}
+
+void Socket::Private::attemptFinished(Socket *s, ConnectAttempt &attempt, int error)
+{
+    auto it = std::find_if(attempts.begin(), attempts.end(),
+                           [&attempt](const auto &a) { return a.get() == &attempt; });
+    if (it == attempts.end())
+        return;
+    auto finished = *it;
+    attempts.erase(it);
+    finished->reactor()->removeDevice(finished);
+
+    if (error) {
+        errno = error;
+        Log::syserr("Error connecting to server");
+        // no need to wait for the delay anymore
+        if (nextCandidate < candidates.size())
+            startAttempt(s);
+        else if (attempts.empty())
+            s->on_disconnect();
+        return;
+    }
+
+    cancelAttempts(s); // the rest lost the race
+    s->fd             = finished->release();
+    s->_writeInterest = false;
+    s->_reactor->addDevice(s->shared_from_this());
+    s->on_connected();
+}
 
-    int s = getaddrinfo(host.c_str(), nullptr, &hints, &result);
-    if (s != 0 || !result) {
-        Log("dns resolve failed for ") << host;
-        disconnectedCallback();
-        return false;
+void Socket::Private::cancelAttempts(Socket *s)
+{
+    if (attemptTimer != Reactor::InvalidTimer) {
+        s->_reactor->cancelTimer(attemptTimer);
+        attemptTimer = Reactor::InvalidTimer;
     }
+    for (auto &a : attempts)
+        a->reactor()->removeDevice(a);
+    attempts.clear();
+    candidates.clear();
+    nextCandidate = 0;
+}
 
-    // just take first from the linked list
-    memcpy(&addr, result->ai_addr, result->ai_addrlen);
-    addr.sin_port = htons(port);
+void Socket::Private::startIdleTimer(Socket *s, std::chrono::milliseconds timeout)
+{
+    // the timer isn't restarted on each read. instead on expiration it's checked when the last
+    // activity happened and the timer is rescheduled for the rest of the timeout if needed.
+    std::weak_ptr<Device> weakSelf = s->shared_from_this();
+    idleTimer = s->_reactor->addTimer(timeout, [this, weakSelf]() {
+        auto self = weakSelf.lock();
+        if (!self)
+            return;
+        idleTimer  = Reactor::InvalidTimer;
+        auto sock  = static_cast<Socket *>(self.get());
+        auto spent = sock->_reactor->now() - lastActivity;
+        if (spent < idleTimeout) {
+            startIdleTimer(sock, idleTimeout - spent);
+            return;
+        }
+        Log("Socket idle timeout: ") << host;
+        sock->on_disconnect();
+    });
+}
 
-    freeaddrinfo(result);
-    return true;
+void Socket::Private::stopIdleTimer(Socket *s)
+{
+    if (idleTimer != Reactor::InvalidTimer) {
+        s->_reactor->cancelTimer(idleTimer);
+        idleTimer = Reactor::InvalidTimer;
+    }
 }
 
-Socket::Socket() : d(new Private) {}
+Socket::Socket() : d(new Private) { setReceivable(true); }
 
-Socket::~Socket() {}
+Socket::~Socket()
+{
+    if (_reactor) {
+        d->stopIdleTimer(this);
+        d->cancelAttempts(this);
+    }
+}
 
 void Socket::setConnectedCallback(Socket::Callback callback) { d->connectedCB = callback; }
 
@@ -94,46 +315,106 @@ void Socket::setReadyReadCallback(Socket::Callback callback) { d->readyReadCB =
 
 void Socket::setReadyWriteCallback(Socket::Callback callback) { d->readyWriteCB = callback; }
 
+void Socket::setIdleTimeout(std::chrono::milliseconds timeout) { d->idleTimeout = timeout; }
+
+void Socket::setOptions(const SocketOptions &options) { d->options = options; }
+
+const SocketOptions &Socket::options() const { return d->options; }
+
+void Socket::setConnector(Socket::Connector connector) { d->connector = std::move(connector); }
+
 const std::string &Socket::remoteHostname() const { return d->host; }
 
-void Socket::connect(const std::string &host, std::uint16_t port)
+std::uint16_t Socket::remotePort() const { return d->port; }
+
+std::string Socket::description() const
 {
-    d->host = host;
-    d->port = port;
-    if (!d->resolveHost())
-        return;
+    return d->host + ":" + std::to_string(d->port) + " " + Device::description();
+}
 
-    fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-    if (fd == -1) {
-        Log::syserr("failed to create socket");
-        on_disconnect();
+void Socket::connect(const std::string &host, std::uint16_t port)
+{
+    d->host  = host;
+    d->port  = port;
+    d->state = Private::Unconnected;
+    _atEnd   = false;
+    // the attempts, their timer and the socket itself call back into Private. on a pool they
+    // would be spread over its threads, so all of them go to one loop
+    if (auto pool = std::dynamic_pointer_cast<ReactorPool>(_reactor))
+        setReactor(pool->selectReactor());
+    if (d->connector) {
+        fd = d->connector(host, port);
+        if (fd == -1) {
+            on_disconnect();
+            return;
+        }
+        _reactor->addDevice(shared_from_this());
+        on_connected();
         return;
     }
 
-    _reactor->addDevice(shared_from_this());
+    d->state = Private::Resolving;
 
-    if (::connect(fd, reinterpret_cast<sockaddr *>(&d->addr), sizeof(d->addr)) == -1) {
-        Log::syserr("Error connecting to server.\n");
-        on_disconnect();
-        return;
-    }
-    on_connected();
+    // the lookup is answered right away for cached hosts. otherwise it's posted back later
+    auto                  attempt    = ++d->attempt;
+    std::weak_ptr<Device> weakSelf   = shared_from_this();
+    auto                  onResolved = [weakSelf, attempt](const Resolver::Addresses &addresses) {
+        auto self = weakSelf.lock();
+        if (!self)
+            return;
+        auto sock = static_cast<Socket *>(self.get());
+        if (sock->d->attempt == attempt && sock->d->state == Private::Resolving)
+            sock->d->connectTo(sock, addresses);
+    };
+    Resolver::instance().resolve(_reactor, host, std::move(onResolved));
+}
+
+Socket::ConnectAwaiter Socket::asyncConnect(const std::string &host, std::uint16_t port)
+{
+    return ConnectAwaiter(*this, host, port);
+}
+
+Socket::ReadAwaiter Socket::asyncRead(std::span<std::byte> buffer)
+{
+    return ReadAwaiter(*this, buffer);
 }
 
 void Socket::disconnect()
 {
+    d->attempt++;
+    d->state = Private::Unconnected;
+    d->cancelAttempts(this);
     if (fd != -1) {
+        d->stopIdleTimer(this);
         _reactor->removeDevice(shared_from_this());
         close(fd);
         fd = -1;
     }
+    discardOutput();
+    discardInput();
 }
 
 void Socket::on_readyRead()
 {
-    if (d->readyReadCB) {
+    if (d->idleTimer != Reactor::InvalidTimer)
+        d->lastActivity = _reactor->now();
+    if (d->options.quickAck && d->state == Private::Connected) {
+        // the kernel falls back to delayed acks after a while
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, &one, sizeof(one));
+    }
+    if (auto waiter = d->readWaiter) {
+        // the waiter is gone if reading caused a disconnect
+        if (!waiter->tryRead() || d->readWaiter != waiter)
+            return;
+        d->readWaiter = nullptr;
+        waiter->_handle.resume();
+    } else if (d->readyReadCB) {
         d->readyReadCB();
     }
+    // the peer is gone and the handler didn't disconnect by itself
+    if (fd != -1 && atEnd())
+        on_disconnect();
 }
 
 void Socket::on_readyWrite()
@@ -145,6 +426,16 @@ void Socket::on_readyWrite()
 
 void Socket::on_connected()
 {
+    if (d->idleTimeout.count()) {
+        d->lastActivity = _reactor->now();
+        d->startIdleTimer(this, d->idleTimeout);
+    }
+
+    d->state = Private::Connected;
+    if (auto waiter = std::exchange(d->connectWaiter, nullptr)) {
+        waiter->_handle.resume();
+        return;
+    }
     if (d->connectedCB)
         d->connectedCB();
 }
@@ -152,8 +443,57 @@ void Socket::on_connected()
 void Socket::on_disconnect()
 {
     disconnect();
+    if (auto waiter = std::exchange(d->connectWaiter, nullptr)) {
+        waiter->_handle.resume();
+        return;
+    }
+    if (auto waiter = std::exchange(d->readWaiter, nullptr)) {
+        waiter->_handle.resume();
+        return;
+    }
     if (d->disconnectedCallback)
         d->disconnectedCallback();
 }
 
+Socket::ConnectAwaiter::~ConnectAwaiter()
+{
+    if (_socket.d->connectWaiter == this)
+        _socket.d->connectWaiter = nullptr;
+}
+
+bool Socket::ConnectAwaiter::await_ready()
+{
+    // connect() either finishes right away or reports the result to on_connected/on_disconnect
+    _socket.connect(_host, _port);
+    auto state = _socket.d->state;
+    return state == Private::Connected || state == Private::Unconnected;
+}
+
+void Socket::ConnectAwaiter::await_suspend(std::coroutine_handle<> handle)
+{
+    _handle                  = handle;
+    _socket.d->connectWaiter = this;
+}
+
+Socket::ReadAwaiter::~ReadAwaiter()
+{
+    if (_socket.d->readWaiter == this)
+        _socket.d->readWaiter = nullptr;
+}
+
+bool Socket::ReadAwaiter::tryRead()
+{
+    if (_socket.fd != -1)
+        _result = _socket.read(_buffer);
+    return _result || _socket.atEnd() || _socket.fd == -1;
+}
+
+bool Socket::ReadAwaiter::await_ready() { return tryRead(); }
+
+void Socket::ReadAwaiter::await_suspend(std::coroutine_handle<> handle)
+{
+    _handle               = handle;
+    _socket.d->readWaiter = this;
+}
+
 } // namespace TM
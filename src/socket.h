@@ -30,6 +30,8 @@
 #ifndef SOCKET_H
 #define SOCKET_H
 
+#include <chrono>
+#include <coroutine>
 #include <functional>
 #include <memory>
 #include <string>
@@ -38,9 +40,24 @@
 
 namespace TM {
 
+// tcp tuning applied to each connection attempt before connect(). zero/false keeps the system
+// default
+struct SocketOptions {
+    bool                      noDelay       = false; // TCP_NODELAY, small writes go out at once
+    bool                      quickAck      = false; // TCP_QUICKACK, re-armed after every read
+    int                       receiveBuffer = 0;     // SO_RCVBUF
+    int                       sendBuffer    = 0;     // SO_SNDBUF
+    std::chrono::milliseconds userTimeout { 0 };     // TCP_USER_TIMEOUT, unacked data lifetime
+    // TCP_FASTOPEN_CONNECT. connect() completes right away and the first write goes with the
+    // SYN if there is a cookie for the server. so the first address always wins the race
+    bool fastOpen = false;
+};
+
 class Socket : public Device {
 public:
     using Callback = std::function<void()>;
+    // opens a connected descriptor to host:port or returns -1 if the connection is refused
+    using Connector = std::function<int(const std::string &host, std::uint16_t port)>;
 
     Socket();
     ~Socket() override;
@@ -50,11 +67,35 @@ public:
     void setReadyReadCallback(Callback callback);
     void setReadyWriteCallback(Callback callback);
 
+    // disconnect if nothing was received for the timeout after the connection was established.
+    // zero disables the timeout
+    void setIdleTimeout(std::chrono::milliseconds timeout);
+
+    // takes effect on the next connect()
+    void                 setOptions(const SocketOptions &options);
+    const SocketOptions &options() const;
+
+    // connections are made by the connector instead of the resolver and tcp (e.g. the in-process
+    // endpoints of ReactorSim). takes effect on the next connect()
+    void setConnector(Connector connector);
+
     const std::string &remoteHostname() const;
+    std::uint16_t      remotePort() const;
+    std::string        description() const override;
 
     virtual void connect(const std::string &host, std::uint16_t port);
     virtual void disconnect();
 
+    class ConnectAwaiter;
+    class ReadAwaiter;
+
+    // awaitable counterparts of connect() and read() for coroutines (see coro.h). a suspended
+    // coroutine is resumed right from the reactor's dispatch instead of the connected/readyRead
+    // callbacks. one reader at a time. the awaiters are valid only within the co_await expression.
+    // the data is read into the caller's buffer, which has to outlive the suspension
+    ConnectAwaiter asyncConnect(const std::string &host, std::uint16_t port);
+    ReadAwaiter    asyncRead(std::span<std::byte> buffer);
+
     void         on_readyRead() override;
     void         on_readyWrite() override;
     virtual void on_connected();
@@ -65,6 +106,52 @@ private:
     std::unique_ptr<Private> d;
 };
 
+// co_await yields false if the connection failed
+class Socket::ConnectAwaiter {
+public:
+    ConnectAwaiter(Socket &socket, const std::string &host, std::uint16_t port) :
+        _socket(socket), _host(host), _port(port)
+    {
+    }
+    ConnectAwaiter(const ConnectAwaiter &) = delete;
+    ~ConnectAwaiter();
+
+    bool await_ready();
+    void await_suspend(std::coroutine_handle<> handle);
+    bool await_resume() const { return _socket.fileDescriptor() != -1; }
+
+private:
+    friend class Socket;
+
+    Socket &                _socket;
+    const std::string &     _host;
+    std::uint16_t           _port;
+    std::coroutine_handle<> _handle;
+};
+
+// co_await fills the buffer with whatever is available as soon as there is anything and yields
+// the number of bytes read. 0 means the peer closed the connection or the socket was disconnected
+class Socket::ReadAwaiter {
+public:
+    ReadAwaiter(Socket &socket, std::span<std::byte> buffer) : _socket(socket), _buffer(buffer) { }
+    ReadAwaiter(const ReadAwaiter &) = delete;
+    ~ReadAwaiter();
+
+    bool        await_ready();
+    void        await_suspend(std::coroutine_handle<> handle);
+    std::size_t await_resume() const { return _result; }
+
+private:
+    friend class Socket;
+
+    bool tryRead();
+
+    Socket &                _socket;
+    std::span<std::byte>    _buffer;
+    std::size_t             _result = 0;
+    std::coroutine_handle<> _handle;
+};
+
 } // namespace TM
 
 #endif // SOCKET_H
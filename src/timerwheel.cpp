@@ -0,0 +1,201 @@
+/*
+ * Copyright (c) 2020 Sergey Ilinykh <rion4ik@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of mosquitto nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <algorithm>
+
+#include "timerwheel.h"
+
+namespace TM {
+
+TimerWheel::TimerWheel(std::uint64_t now) : _current(now)
+{
+    std::fill(&_slots[0][0], &_slots[0][0] + Levels * Slots, Nil);
+}
+
+TimerWheel::TimerId TimerWheel::schedule(std::uint64_t expires, Callback callback)
+{
+    std::uint32_t idx;
+    if (_freeList != Nil) {
+        idx       = _freeList;
+        _freeList = _nodes[idx].next;
+    } else {
+        idx = std::uint32_t(_nodes.size());
+        _nodes.emplace_back();
+    }
+    auto &node    = _nodes[idx];
+    node.callback = std::move(callback);
+    node.expires  = expires;
+    link(idx);
+    _count++;
+    return (TimerId(node.generation) << 32) | idx;
+}
+
+bool TimerWheel::cancel(TimerId id)
+{
+    auto idx = std::uint32_t(id);
+    if (idx >= _nodes.size())
+        return false;
+    auto &node = _nodes[idx];
+    if (node.level == Free || node.generation != ((id >> 32) & GenMask))
+        return false;
+    if (node.level < Levels)
+        _levelCount[node.level]--;
+    unlink(idx);
+    release(idx);
+    return true;
+}
+
+void TimerWheel::advance(std::uint64_t now)
+{
+    while (_current <= now) {
+        if (!_count) {
+            _current = now + 1;
+            break;
+        }
+
+        auto idx = _current & (Slots - 1);
+        if (idx == 0) {
+            for (int level = 1; level < Levels; level++) {
+                cascade(level);
+                if ((_current >> (level * SlotBits)) & (Slots - 1))
+                    break;
+            }
+        } else if (!_levelCount[0]) {
+            // nothing can fire till the next cascade
+            _current = std::min((_current | (Slots - 1)) + 1, now + 1);
+            continue;
+        }
+
+        _expiring      = _slots[0][idx];
+        _slots[0][idx] = Nil;
+        for (auto i = _expiring; i != Nil; i = _nodes[i].next) {
+            _nodes[i].level = Expiring;
+            _levelCount[0]--;
+        }
+        // timers scheduled from callbacks must not land into the slot being fired
+        _current++;
+
+        while (_expiring != Nil) {
+            auto i = _expiring;
+            unlink(i);
+            auto callback = std::move(_nodes[i].callback);
+            release(i);
+            callback(); // may schedule/cancel other timers
+        }
+    }
+}
+
+std::uint64_t TimerWheel::nextExpiry() const
+{
+    if (!_count)
+        return NoTimers;
+
+    std::uint64_t ret = NoTimers;
+    if (_levelCount[0]) {
+        for (std::uint64_t t = _current; t < _current + Slots; t++) {
+            if (_slots[0][t & (Slots - 1)] != Nil) {
+                ret = t;
+                break;
+            }
+        }
+    }
+    if (_count > _levelCount[0]) {
+        // some timers wait for cascade on the next slot boundary
+        auto boundary = (_current & (Slots - 1)) ? (_current | (Slots - 1)) + 1 : _current;
+        ret           = std::min(ret, boundary);
+    }
+    return ret;
+}
+
+std::uint32_t &TimerWheel::head(const Node &node)
+{
+    return node.level == Expiring ? _expiring : _slots[node.level][node.slot];
+}
+
+void TimerWheel::link(std::uint32_t idx)
+{
+    auto &node    = _nodes[idx];
+    auto  expires = std::max(node.expires, _current);
+    auto  delta   = expires - _current;
+
+    int level = 0;
+    while (level < Levels - 1 && delta >= (std::uint64_t(1) << ((level + 1) * SlotBits)))
+        level++;
+    if (level == Levels - 1 && delta > UINT32_MAX)
+        expires = _current + UINT32_MAX; // will be relinked on cascade
+
+    node.level = std::uint8_t(level);
+    node.slot  = std::uint8_t((expires >> (level * SlotBits)) & (Slots - 1));
+    node.prev  = Nil;
+    auto &h    = head(node);
+    node.next  = h;
+    if (h != Nil)
+        _nodes[h].prev = idx;
+    h = idx;
+    _levelCount[level]++;
+}
+
+void TimerWheel::unlink(std::uint32_t idx)
+{
+    auto &node = _nodes[idx];
+    if (node.prev != Nil)
+        _nodes[node.prev].next = node.next;
+    else
+        head(node) = node.next;
+    if (node.next != Nil)
+        _nodes[node.next].prev = node.prev;
+}
+
+void TimerWheel::cascade(int level)
+{
+    auto &slot = _slots[level][(_current >> (level * SlotBits)) & (Slots - 1)];
+    auto  idx  = slot;
+    slot       = Nil;
+    while (idx != Nil) {
+        auto next = _nodes[idx].next;
+        _levelCount[level]--;
+        link(idx);
+        idx = next;
+    }
+}
+
+void TimerWheel::release(std::uint32_t idx)
+{
+    auto &node      = _nodes[idx];
+    node.callback   = nullptr;
+    node.generation = (node.generation + 1) & GenMask;
+    if (!node.generation)
+        node.generation = 1;
+    node.level = Free;
+    node.next  = _freeList;
+    _freeList  = idx;
+    _count--;
+}
+
+} // namespace TM
@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2020 Sergey Ilinykh <rion4ik@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of mosquitto nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace TM {
+
+/**
+ * @brief TimerWheel is a hierarchical timing wheel (4 levels of 256 slots).
+ *
+ * Time is measured in abstract ticks (the reactors use milliseconds) and is driven by advance().
+ * Both schedule() and cancel() are O(1). Timer nodes are kept in a flat vector and reused, so
+ * steady state scheduling doesn't allocate except for the callback itself.
+ */
+class TimerWheel {
+public:
+    using TimerId  = std::uint64_t;
+    using Callback = std::function<void()>;
+
+    static constexpr TimerId       InvalidTimer = 0;
+    static constexpr std::uint64_t NoTimers     = UINT64_MAX;
+
+    TimerWheel(std::uint64_t now = 0);
+
+    // schedules callback at absolute tick. overdue timers fire on the next advance()
+    TimerId schedule(std::uint64_t expires, Callback callback);
+    bool    cancel(TimerId id);
+
+    // fires all the timers expired by `now` (inclusive)
+    void advance(std::uint64_t now);
+
+    // the tick when advance() has to be called next or NoTimers.
+    // may be earlier than the real expiry when timers have to be moved between levels.
+    std::uint64_t nextExpiry() const;
+
+    std::size_t size() const { return _count; }
+
+private:
+    static constexpr int           Levels   = 4;
+    static constexpr int           SlotBits = 8;
+    static constexpr int           Slots    = 1 << SlotBits;
+    static constexpr std::uint32_t Nil      = UINT32_MAX;
+    static constexpr std::uint8_t  Expiring = Levels; // pseudo-level of the list being fired
+    static constexpr std::uint8_t  Free     = Levels + 1;
+    static constexpr std::uint32_t GenMask  = 0xffffff; // top byte of ids is left for ReactorPool
+
+    struct Node {
+        Callback      callback;
+        std::uint64_t expires;
+        std::uint32_t prev;
+        std::uint32_t next;
+        std::uint32_t generation = 1;
+        std::uint8_t  level      = Free;
+        std::uint8_t  slot       = 0;
+    };
+
+    std::uint32_t &head(const Node &node);
+    void           link(std::uint32_t idx);
+    void           unlink(std::uint32_t idx);
+    void           cascade(int level);
+    void           release(std::uint32_t idx);
+
+    std::vector<Node> _nodes;
+    std::uint32_t     _freeList = Nil;
+    std::uint32_t     _expiring = Nil;
+    std::uint32_t     _slots[Levels][Slots];
+    std::size_t       _levelCount[Levels] = {};
+    std::size_t       _count              = 0;
+    std::uint64_t     _current; // next tick to process
+};
+
+} // namespace TM
+
+#endif // TIMERWHEEL_H
@@ -0,0 +1,208 @@
+/*
+ * Copyright (c) 2020 Sergey Ilinykh <rion4ik@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of mosquitto nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <ctime>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+#include "exception.h"
+#include "log.h"
+#include "tlscontext.h"
+
+namespace TM {
+
+// the host:port key of the connection, to find where a new session belongs
+static int keyIndex()
+{
+    static int index = SSL_get_ex_new_index(
+        0, nullptr, nullptr, nullptr,
+        [](void *, void *ptr, CRYPTO_EX_DATA *, int, long, void *) {
+            delete static_cast<std::string *>(ptr);
+        });
+    return index;
+}
+
+struct TlsContext::Private {
+    using Lru = std::list<std::pair<std::string, SSL_SESSION *>>; // the most recent first
+
+    Config                                       config;
+    SSL_CTX *                                    ctx = nullptr;
+    mutable std::mutex                           mutex;
+    Lru                                          lru;
+    std::unordered_map<std::string, Lru::iterator> sessions;
+
+    static int onNewSession(SSL *ssl, SSL_SESSION *session);
+
+    void         store(const std::string &key, SSL_SESSION *session);
+    SSL_SESSION *take(const std::string &key);
+    void         drop(Lru::iterator it);
+};
+
+int TlsContext::Private::onNewSession(SSL *ssl, SSL_SESSION *session)
+{
+    auto key  = static_cast<std::string *>(SSL_get_ex_data(ssl, keyIndex()));
+    auto self = static_cast<TlsContext::Private *>(SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl)));
+    if (!key || !self || !self->config.sessionCacheSize || !SSL_SESSION_is_resumable(session))
+        return 0;
+    self->store(*key, session);
+    return 1; // the reference is ours now
+}
+
+void TlsContext::Private::store(const std::string &key, SSL_SESSION *session)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto                        it = sessions.find(key);
+    if (it != sessions.end())
+        drop(it->second);
+    lru.emplace_front(key, session);
+    sessions.emplace(key, lru.begin());
+    while (lru.size() > config.sessionCacheSize)
+        drop(std::prev(lru.end()));
+}
+
+SSL_SESSION *TlsContext::Private::take(const std::string &key)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto                        it = sessions.find(key);
+    if (it == sessions.end())
+        return nullptr;
+    auto session = it->second->second;
+    if (std::time(nullptr) >= SSL_SESSION_get_time(session) + SSL_SESSION_get_timeout(session)) {
+        drop(it->second);
+        return nullptr;
+    }
+    if (SSL_SESSION_get_protocol_version(session) == TLS1_3_VERSION) {
+        // single use. the reference goes to the caller
+        lru.erase(it->second);
+        sessions.erase(it);
+        return session;
+    }
+    lru.splice(lru.begin(), lru, it->second);
+    SSL_SESSION_up_ref(session);
+    return session;
+}
+
+void TlsContext::Private::drop(Lru::iterator it)
+{
+    SSL_SESSION_free(it->second);
+    sessions.erase(it->first);
+    lru.erase(it);
+}
+
+static std::mutex                  defaultMutex;
+static std::shared_ptr<TlsContext> defaultInstance;
+
+TlsContext::TlsContext() : TlsContext(Config()) { }
+
+TlsContext::TlsContext(const Config &config) : d(new Private)
+{
+    d->config = config;
+    d->ctx    = SSL_CTX_new(TLS_client_method());
+    if (!d->ctx)
+        throw TlsException("SSL context init error");
+    SSL_CTX_set_app_data(d->ctx, d.get());
+
+    if (config.verifyPeer) {
+        SSL_CTX_set_verify(d->ctx, SSL_VERIFY_PEER, nullptr);
+        auto caFile = config.caFile.empty() ? nullptr : config.caFile.c_str();
+        auto caPath = config.caPath.empty() ? nullptr : config.caPath.c_str();
+        bool loaded = !caFile && !caPath ? SSL_CTX_set_default_verify_paths(d->ctx)
+                                         : SSL_CTX_load_verify_locations(d->ctx, caFile, caPath);
+        if (!loaded)
+            Log("failed to load trusted certificates");
+    }
+
+    if (config.kernelTls) {
+#ifdef SSL_OP_ENABLE_KTLS
+        SSL_CTX_set_options(d->ctx, SSL_OP_ENABLE_KTLS);
+#else
+        Log("kernel TLS isn't supported by this openssl build");
+#endif
+    }
+
+    // openssl keeps no client sessions by itself. they come to onNewSession, including the
+    // tls 1.3 tickets sent after the handshake
+    SSL_CTX_set_session_cache_mode(d->ctx,
+                                   SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(d->ctx, &Private::onNewSession);
+}
+
+TlsContext::~TlsContext()
+{
+    clearSessions();
+    SSL_CTX_free(d->ctx);
+}
+
+std::shared_ptr<TlsContext> TlsContext::defaultContext()
+{
+    std::lock_guard<std::mutex> lock(defaultMutex);
+    if (!defaultInstance)
+        defaultInstance = std::make_shared<TlsContext>();
+    return defaultInstance;
+}
+
+void TlsContext::setDefaultContext(std::shared_ptr<TlsContext> context)
+{
+    std::lock_guard<std::mutex> lock(defaultMutex);
+    defaultInstance = std::move(context);
+}
+
+SSL_CTX *TlsContext::handle() const { return d->ctx; }
+
+const TlsContext::Config &TlsContext::config() const { return d->config; }
+
+void TlsContext::prepare(SSL *ssl, const std::string &host, std::uint16_t port)
+{
+    SSL_set_tlsext_host_name(ssl, host.c_str());
+    if (d->config.verifyPeer)
+        SSL_set1_host(ssl, host.c_str());
+
+    auto key = new std::string(host + ":" + std::to_string(port));
+    SSL_set_ex_data(ssl, keyIndex(), key);
+    if (auto session = d->take(*key)) {
+        SSL_set_session(ssl, session);
+        SSL_SESSION_free(session);
+    }
+}
+
+std::size_t TlsContext::sessionCount() const
+{
+    std::lock_guard<std::mutex> lock(d->mutex);
+    return d->lru.size();
+}
+
+void TlsContext::clearSessions()
+{
+    std::lock_guard<std::mutex> lock(d->mutex);
+    while (!d->lru.empty())
+        d->drop(d->lru.begin());
+}
+
+} // namespace TM
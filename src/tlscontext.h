@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2020 Sergey Ilinykh <rion4ik@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of mosquitto nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef TLSCONTEXT_H
+#define TLSCONTEXT_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include <openssl/ssl.h>
+
+namespace TM {
+
+class WorkerPool;
+
+/**
+ * @brief TlsContext is the client side TLS configuration shared by secure sockets.
+ *
+ * It owns the SSL_CTX, so certificates are loaded once instead of per connection, and keeps
+ * a cache of sessions keyed by host and port. The sessions (TLS 1.3 tickets included) are
+ * stored as the servers issue them and offered on the next connection to the same server,
+ * which then does an abbreviated handshake. TLS 1.3 tickets are used only once as RFC 8446
+ * recommends, the servers send fresh ones on every connection. Thread safe.
+ */
+class TlsContext {
+public:
+    struct Config {
+        bool        verifyPeer = false; // check the certificate chain and the host name
+        std::string caFile;             // trusted certificates. the system ones if both empty
+        std::string caPath;
+        std::size_t sessionCacheSize = 256; // servers to remember a session for. 0 disables
+        // kTLS: after the handshake record encryption/decryption moves into the kernel if both
+        // the kernel (tls module) and the negotiated cipher support it. silently off otherwise
+        bool kernelTls = false;
+        // the cpu heavy handshake steps (key exchange, certificate checks) run there, so a burst
+        // of new connections doesn't delay the established ones on the reactor thread. the
+        // handshake runs in place when the pool's queue is full. not used with kernelTls
+        std::shared_ptr<WorkerPool> handshakeWorkers;
+    };
+
+    TlsContext();
+    explicit TlsContext(const Config &config);
+    ~TlsContext();
+    TlsContext(const TlsContext &) = delete;
+    TlsContext &operator=(const TlsContext &) = delete;
+
+    // used by the sockets without a context of their own
+    static std::shared_ptr<TlsContext> defaultContext();
+    static void                        setDefaultContext(std::shared_ptr<TlsContext> context);
+
+    SSL_CTX *     handle() const;
+    const Config &config() const;
+
+    // sets up a new connection to host:port: server name, host verification and the session
+    // to resume if there is one. the sessions the server issues are cached from now on
+    void prepare(SSL *ssl, const std::string &host, std::uint16_t port);
+
+    std::size_t sessionCount() const;
+    void        clearSessions();
+
+private:
+    struct Private;
+    std::unique_ptr<Private> d;
+};
+
+} // namespace TM
+
+#endif // TLSCONTEXT_H
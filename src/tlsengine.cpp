@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) 2020 Sergey Ilinykh <rion4ik@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of mosquitto nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+
+#include "exception.h"
+#include "tlsengine.h"
+
+namespace TM {
+
+struct TlsEngine::Private {
+    SSL *       ssl      = nullptr;
+    bool        buffered = false;
+    BufferChain input;
+    BufferChain output;
+
+    static BIO_METHOD *method();
+    static int         bioRead(BIO *bio, char *data, int size);
+    static int         bioWrite(BIO *bio, const char *data, int size);
+    static long        bioCtrl(BIO *bio, int cmd, long num, void *ptr);
+};
+
+BIO_METHOD *TlsEngine::Private::method()
+{
+    static BIO_METHOD *method = []() {
+        auto m = BIO_meth_new(BIO_get_new_index() | BIO_TYPE_SOURCE_SINK, "TM::TlsEngine");
+        BIO_meth_set_read(m, &bioRead);
+        BIO_meth_set_write(m, &bioWrite);
+        BIO_meth_set_ctrl(m, &bioCtrl);
+        BIO_meth_set_create(m, [](BIO *bio) {
+            BIO_set_init(bio, 1);
+            return 1;
+        });
+        return m;
+    }();
+    return method;
+}
+
+int TlsEngine::Private::bioRead(BIO *bio, char *data, int size)
+{
+    auto self = static_cast<Private *>(BIO_get_data(bio));
+    BIO_clear_retry_flags(bio);
+    if (self->input.empty()) {
+        BIO_set_retry_read(bio);
+        return -1;
+    }
+    // usually a record header first and then its body, both from the front slice
+    std::size_t len = 0;
+    for (auto const &slice : self->input.slices()) {
+        auto n = std::min(slice.size(), std::size_t(size) - len);
+        std::memcpy(data + len, slice.view().data(), n);
+        len += n;
+        if (len == std::size_t(size))
+            break;
+    }
+    self->input.consume(len);
+    return int(len);
+}
+
+int TlsEngine::Private::bioWrite(BIO *bio, const char *data, int size)
+{
+    auto self = static_cast<Private *>(BIO_get_data(bio));
+    BIO_clear_retry_flags(bio);
+    if (self->output.size() >= OutputLimit) {
+        BIO_set_retry_write(bio);
+        return -1;
+    }
+    auto space = self->output.prepare(std::size_t(size));
+    std::memcpy(space.data(), data, std::size_t(size));
+    self->output.commit(std::size_t(size));
+    return size;
+}
+
+long TlsEngine::Private::bioCtrl(BIO *bio, int cmd, long, void *)
+{
+    auto self = static_cast<Private *>(BIO_get_data(bio));
+    switch (cmd) {
+    case BIO_CTRL_FLUSH:
+        return 1; // sending is up to the owner of the transport
+    case BIO_CTRL_PENDING:
+        return long(std::min<std::size_t>(self->input.size(), LONG_MAX));
+    case BIO_CTRL_WPENDING:
+        return long(std::min<std::size_t>(self->output.size(), LONG_MAX));
+    default:
+        return 0;
+    }
+}
+
+TlsEngine::TlsEngine(SSL *ssl) : d(new Private)
+{
+    d->ssl   = ssl;
+    auto bio = BIO_new(Private::method());
+    if (!bio) {
+        SSL_free(ssl);
+        throw TlsException("TLS engine init error");
+    }
+    BIO_set_data(bio, d.get());
+    SSL_set_bio(ssl, bio, bio); // takes the only reference
+    d->buffered = true;
+}
+
+TlsEngine::TlsEngine(SSL *ssl, int fd) : d(new Private)
+{
+    d->ssl = ssl;
+    SSL_set_fd(ssl, fd);
+}
+
+TlsEngine::~TlsEngine() { SSL_free(d->ssl); }
+
+SSL *TlsEngine::handle() const { return d->ssl; }
+
+bool TlsEngine::buffered() const { return d->buffered; }
+
+BufferChain &TlsEngine::input() { return d->input; }
+
+BufferChain &TlsEngine::output() { return d->output; }
+
+} // namespace TM
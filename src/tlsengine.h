@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2020 Sergey Ilinykh <rion4ik@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of mosquitto nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef TLSENGINE_H
+#define TLSENGINE_H
+
+#include <memory>
+
+#include <openssl/ssl.h>
+
+#include "bufferchain.h"
+
+namespace TM {
+
+/**
+ * @brief TlsEngine connects an SSL object to its transport through buffers instead of an fd.
+ *
+ * OpenSSL reads ciphertext from input() and writes the records it makes to output(). Whoever
+ * owns the transport fills the one (a large read may bring many records at once) and sends
+ * the other (gathered, in one writev), so the same TLS code runs over sockets, io_uring or an
+ * in-memory pipe in tests. Missing input gives SSL_ERROR_WANT_READ as usual. Output is
+ * accepted up to OutputLimit, then openssl is told to retry (SSL_ERROR_WANT_WRITE), so a
+ * stalled transport holds encryption back.
+ *
+ * OpenSSL offloads to kTLS only on its own socket BIO, so the engine can be bound to an fd
+ * instead. The buffers stay empty then.
+ */
+class TlsEngine {
+public:
+    static constexpr std::size_t OutputLimit = 65536;
+
+    // takes ownership of ssl
+    explicit TlsEngine(SSL *ssl);
+    TlsEngine(SSL *ssl, int fd);
+    ~TlsEngine();
+    TlsEngine(const TlsEngine &) = delete;
+    TlsEngine &operator=(const TlsEngine &) = delete;
+
+    SSL *handle() const;
+    // false if bound to an fd
+    bool buffered() const;
+
+    BufferChain &input();
+    BufferChain &output();
+
+private:
+    struct Private;
+    std::unique_ptr<Private> d;
+};
+
+} // namespace TM
+
+#endif // TLSENGINE_H
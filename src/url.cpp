@@ -36,18 +36,18 @@ namespace TM {
 
 Url::Url(const std::string &url) : _url(url)
 {
-    // yep, no auth in regexp and
-    std::regex  re("^(https?)://([^:/#]+)(?::([0-9]+))?([/#?].*)?$");
+    // yep, no auth in regexp and. ipv6 addresses are in brackets
+    std::regex  re("^(https?)://(?:\\[([0-9A-Fa-f:.]+)\\]|([^:/#\\[]+))(?::([0-9]+))?([/#?].*)?$");
     std::smatch match;
 
     if (!std::regex_match(url, match, re))
         throw std::invalid_argument(url);
 
     _scheme = match[1].str() == "http" ? Http : Https;
-    _host   = match[2].str();
-    _port   = match[3].length() ? std::uint16_t(std::atoi(match[3].str().c_str()))
+    _host   = match[2].length() ? match[2].str() : match[3].str();
+    _port   = match[4].length() ? std::uint16_t(std::atoi(match[4].str().c_str()))
                               : _scheme == Http ? 80 : 443;
-    _uri = match[4];
+    _uri = match[5];
 }
 
 } // namespace TM
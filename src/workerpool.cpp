@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2020 Sergey Ilinykh <rion4ik@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of mosquitto nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <algorithm>
+
+#include "reactor.h"
+#include "workerpool.h"
+
+namespace TM {
+
+WorkerPool::WorkerPool(std::size_t threads, std::size_t maxQueued) :
+    _maxThreads(std::max<std::size_t>(threads, 1)), _maxQueued(maxQueued)
+{
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _cond.notify_all();
+    for (auto &t : _threads)
+        t.join();
+}
+
+bool WorkerPool::submit(std::shared_ptr<Reactor> reactor, Job job, Job done)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_stopping || _queue.size() >= _maxQueued)
+        return false;
+    _queue.push_back(Task { std::move(reactor), std::move(job), std::move(done) });
+    if (_idle)
+        _cond.notify_one();
+    else if (_threads.size() < _maxThreads)
+        _threads.emplace_back([this]() { worker(); });
+    return true;
+}
+
+std::size_t WorkerPool::queued() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _queue.size();
+}
+
+void WorkerPool::worker()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true) {
+        _idle++;
+        _cond.wait(lock, [this]() { return _stopping || !_queue.empty(); });
+        _idle--;
+        if (_stopping)
+            return;
+        auto task = std::move(_queue.front());
+        _queue.pop_front();
+
+        lock.unlock();
+        task.job();
+        task.reactor->post(std::move(task.done));
+        lock.lock();
+    }
+}
+
+} // namespace TM
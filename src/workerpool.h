@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2020 Sergey Ilinykh <rion4ik@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of mosquitto nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace TM {
+
+class Reactor;
+
+/**
+ * @brief WorkerPool runs CPU heavy jobs (e.g. TLS handshake crypto) off the reactor threads.
+ *
+ * Jobs run on up to the given number of threads, started on demand, and their completion is
+ * posted back to the requester's reactor. Both the threads and the queue are bounded: a job
+ * beyond the queue limit is refused, so the caller does the work itself instead of waiting
+ * behind a backlog.
+ */
+class WorkerPool {
+public:
+    using Job = std::function<void()>;
+
+    WorkerPool(std::size_t threads = 2, std::size_t maxQueued = 256);
+    ~WorkerPool();
+    WorkerPool(const WorkerPool &) = delete;
+    WorkerPool &operator=(const WorkerPool &) = delete;
+
+    // runs job on a worker, then posts done to the reactor. false if the queue is full
+    bool submit(std::shared_ptr<Reactor> reactor, Job job, Job done);
+
+    std::size_t queued() const;
+
+private:
+    struct Task {
+        std::shared_ptr<Reactor> reactor;
+        Job                      job;
+        Job                      done;
+    };
+
+    void worker();
+
+    std::size_t              _maxThreads;
+    std::size_t              _maxQueued;
+    mutable std::mutex       _mutex;
+    std::condition_variable  _cond;
+    bool                     _stopping = false;
+    std::size_t              _idle     = 0; // threads waiting for work
+    std::deque<Task>         _queue;
+    std::vector<std::thread> _threads; // started on demand
+};
+
+} // namespace TM
+
+#endif // WORKERPOOL_H
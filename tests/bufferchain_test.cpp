@@ -0,0 +1,91 @@
+#include <cstring>
+#include <gtest/gtest.h>
+
+#include "bufferchain.h"
+
+static void append(TM::BufferChain &chain, std::string_view data)
+{
+    auto space = chain.prepare(data.size());
+    std::memcpy(space.data(), data.data(), data.size());
+    chain.commit(data.size());
+}
+
+TEST(bufferchain, append_in_place)
+{
+    TM::BufferChain chain;
+    append(chain, "hello ");
+    append(chain, "world");
+    ASSERT_EQ(chain.size(), 11);
+    ASSERT_EQ(chain.slices().size(), 1); // both landed into the same block
+    ASSERT_EQ(chain.contiguous(), "hello world");
+}
+
+TEST(bufferchain, split_shares_blocks)
+{
+    TM::BufferChain chain;
+    append(chain, "HTTP/1.1 200 OK\r\n\r\nbody");
+    auto data = chain.contiguous().data();
+
+    auto headers = chain.split(19);
+    ASSERT_EQ(headers.toString(), "HTTP/1.1 200 OK\r\n\r\n");
+    ASSERT_EQ(chain.toString(), "body");
+    ASSERT_EQ(chain.contiguous().data(), data + 19); // not copied
+
+    // a copy shares the bytes but doesn't append to the same block
+    TM::BufferChain copy(chain);
+    append(copy, "!");
+    append(chain, "?");
+    ASSERT_EQ(copy.toString(), "body!");
+    ASSERT_EQ(chain.toString(), "body?");
+}
+
+TEST(bufferchain, find_across_slices)
+{
+    TM::BufferChain chain;
+    for (auto part : { "abc\r", "\n", "\r\nde", "f\r\n\r\n" }) {
+        chain.append(TM::BufferChain(part));
+    }
+    ASSERT_EQ(chain.slices().size(), 4);
+    ASSERT_EQ(chain.find("\r\n\r\n"), 3);
+    ASSERT_EQ(chain.find("\r\n\r\n", 4), 10);
+    ASSERT_EQ(chain.find("cd"), TM::BufferChain::npos);
+    ASSERT_EQ(chain.find("\nde"), 6);
+
+    ASSERT_EQ(chain.contiguous(), "abc\r\n\r\ndef\r\n\r\n");
+    ASSERT_EQ(chain.slices().size(), 1);
+}
+
+TEST(bufferchain, reserve)
+{
+    TM::BufferChain chain;
+    append(chain, "headers|");
+    chain.split(8);
+    append(chain, "body");
+    chain.reserve(100000);
+    auto data = chain.contiguous().data();
+    for (int i = 0; i < 1000; i++)
+        append(chain, std::string(96, 'x'));
+    ASSERT_EQ(chain.slices().size(), 1);
+    ASSERT_EQ(chain.contiguous().data(), data);
+    ASSERT_EQ(chain.size(), 96004);
+}
+
+TEST(bufferchain, consume_rewinds)
+{
+    TM::BufferChain chain;
+    append(chain, "record one");
+    auto data = chain.slices().front().view().data();
+    chain.consume(7);
+    ASSERT_EQ(chain.toString(), "one");
+    chain.consume(3);
+    ASSERT_TRUE(chain.empty());
+    append(chain, "record two");
+    ASSERT_EQ(chain.slices().front().view().data(), data);
+
+    // the bytes are still referred to by the copy
+    TM::BufferChain copy = chain;
+    chain.consume(chain.size());
+    append(chain, "three");
+    ASSERT_NE(chain.slices().front().view().data(), data);
+    ASSERT_EQ(copy.toString(), "record two");
+}
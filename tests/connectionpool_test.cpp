@@ -0,0 +1,270 @@
+#include <arpa/inet.h>
+#include <atomic>
+#include <gtest/gtest.h>
+#include <future>
+#include <mutex>
+#include <netinet/in.h>
+#include <set>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+#include "connectionpool.h"
+#include "httpclient.h"
+#include "reactor.h"
+
+using namespace std::chrono_literals;
+
+// loopback http/1.1 server answering "hello" (or "hello world" in chunks) to any number of
+// requests per connection. after the given number of answers the connection is closed, either
+// right away or when the next request comes
+class KeepAliveServer {
+public:
+    enum Close { Never, AfterAnswers, OnNextRequest };
+
+    KeepAliveServer(Close mode = Never, int answers = 0, bool chunked = false) :
+        _mode(mode), _answers(answers), _chunked(chunked)
+    {
+        _fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr {};
+        addr.sin_family      = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t len        = sizeof(addr);
+        bind(_fd, reinterpret_cast<sockaddr *>(&addr), len);
+        listen(_fd, 16);
+        getsockname(_fd, reinterpret_cast<sockaddr *>(&addr), &len);
+        port    = ntohs(addr.sin_port);
+        _thread = std::thread([this]() {
+            int fd;
+            while ((fd = accept(_fd, nullptr, nullptr)) != -1) {
+                connections++;
+                std::lock_guard<std::mutex> lock(_mutex);
+                _open.insert(fd);
+                _workers.emplace_back([this, fd]() { serve(fd); });
+            }
+        });
+    }
+    ~KeepAliveServer()
+    {
+        shutdown(_fd, SHUT_RDWR);
+        _thread.join();
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            for (int fd : _open)
+                shutdown(fd, SHUT_RDWR);
+        }
+        for (auto &t : _workers)
+            t.join();
+        close(_fd);
+    }
+
+    std::string url() const { return "http://127.0.0.1:" + std::to_string(port) + "/"; }
+
+    std::uint16_t    port = 0;
+    std::atomic<int> connections { 0 };
+    std::atomic<int> requests { 0 };
+    std::atomic<int> closed { 0 }; // connections closed by the clients or the server
+
+private:
+    void serve(int fd)
+    {
+        std::string request;
+        char        buf[1024];
+        ssize_t     n;
+        for (int answered = 0;; answered++) {
+            while (request.find("\r\n\r\n") == std::string::npos
+                   && (n = recv(fd, buf, sizeof(buf), 0)) > 0)
+                request.append(buf, std::size_t(n));
+            if (request.find("\r\n\r\n") == std::string::npos)
+                break; // the client is gone
+            if (_mode == OnNextRequest && answered == _answers)
+                break;
+            requests++;
+            request.erase(0, request.find("\r\n\r\n") + 4);
+            if (_chunked) {
+                // split in the middle of a chunk size line
+                const char head[] = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+                                    "5;ext=1\r\nhello\r\n6";
+                const char tail[] = "\r\n world\r\n0\r\nX-Trailer: 1\r\n\r\n";
+                send(fd, head, sizeof(head) - 1, MSG_NOSIGNAL);
+                std::this_thread::sleep_for(5ms);
+                send(fd, tail, sizeof(tail) - 1, MSG_NOSIGNAL);
+            } else {
+                const char response[] = "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nhello";
+                send(fd, response, sizeof(response) - 1, MSG_NOSIGNAL);
+            }
+            if (_mode == AfterAnswers && answered + 1 == _answers)
+                break;
+        }
+        std::lock_guard<std::mutex> lock(_mutex);
+        _open.erase(fd);
+        close(fd);
+        closed++;
+    }
+
+    Close                    _mode;
+    int                      _answers;
+    bool                     _chunked;
+    int                      _fd;
+    std::thread              _thread;
+    std::mutex               _mutex;
+    std::set<int>            _open;
+    std::vector<std::thread> _workers;
+};
+
+// runs the requests concurrently on the reactor
+static std::vector<std::string> fetch(std::shared_ptr<TM::Reactor> reactor, const std::string &url,
+                                      std::shared_ptr<TM::ConnectionPool> pool,
+                                      std::size_t                         count = 1)
+{
+    std::vector<std::shared_ptr<TM::HttpClient>> clients;
+    std::vector<std::string>                     results(count);
+    int                                          pending = int(count);
+    for (std::size_t i = 0; i < results.size(); i++) {
+        auto client = std::make_shared<TM::HttpClient>(reactor, url);
+        client->setConnectionPool(pool);
+        client->execute([&, i](std::string &&body) {
+            results[i] = std::move(body);
+            if (!--pending)
+                reactor->stop();
+        });
+        clients.push_back(client);
+    }
+    reactor->start();
+    return results;
+}
+
+TEST(connectionpool, reuse)
+{
+    KeepAliveServer server;
+    auto            reactor = TM::Reactor::factory("epoll");
+    auto            pool    = std::make_shared<TM::ConnectionPool>();
+
+    for (int i = 0; i < 3; i++)
+        ASSERT_EQ(fetch(reactor, server.url(), pool).front(), "hello");
+    ASSERT_EQ(server.connections, 1);
+    ASSERT_EQ(server.requests, 3);
+    ASSERT_EQ(pool->idleCount(), 1);
+
+    // the same client again
+    auto        client = std::make_shared<TM::HttpClient>(reactor, server.url());
+    std::string result;
+    client->setConnectionPool(pool);
+    for (int i = 0; i < 2; i++) {
+        client->execute([&](std::string &&body) {
+            result = std::move(body);
+            reactor->stop();
+        });
+        reactor->start();
+        ASSERT_EQ(result, "hello");
+    }
+    ASSERT_EQ(server.connections, 1);
+
+    // another reactor has connections of its own
+    ASSERT_EQ(fetch(TM::Reactor::factory("epoll"), server.url(), pool).front(), "hello");
+    ASSERT_EQ(server.connections, 2);
+    ASSERT_EQ(pool->idleCount(), 2);
+}
+
+TEST(connectionpool, max_idle_per_host)
+{
+    KeepAliveServer            server;
+    auto                       reactor = TM::Reactor::factory("epoll");
+    TM::ConnectionPool::Config config;
+    config.maxIdlePerHost = 2;
+    auto pool             = std::make_shared<TM::ConnectionPool>(config);
+
+    for (auto const &result : fetch(reactor, server.url(), pool, 3))
+        ASSERT_EQ(result, "hello");
+    ASSERT_EQ(server.connections, 3);
+    ASSERT_EQ(pool->idleCount(), 2);
+
+    for (auto const &result : fetch(reactor, server.url(), pool, 3))
+        ASSERT_EQ(result, "hello");
+    ASSERT_EQ(server.connections, 4);
+}
+
+TEST(connectionpool, idle_timeout)
+{
+    KeepAliveServer            server;
+    auto                       reactor = TM::Reactor::factory("epoll");
+    TM::ConnectionPool::Config config;
+    config.idleTimeout = 50ms;
+    auto pool          = std::make_shared<TM::ConnectionPool>(config);
+
+    ASSERT_EQ(fetch(reactor, server.url(), pool).front(), "hello");
+    ASSERT_EQ(pool->idleCount(), 1);
+    reactor->addTimer(100ms, [&]() { reactor->stop(); });
+    reactor->start();
+    ASSERT_EQ(pool->idleCount(), 0);
+
+    ASSERT_EQ(fetch(reactor, server.url(), pool).front(), "hello");
+    ASSERT_EQ(server.connections, 2);
+}
+
+TEST(connectionpool, closed_by_server)
+{
+    // the idle connection is closed before it's taken. the health check drops it
+    KeepAliveServer server(KeepAliveServer::AfterAnswers, 1);
+    auto            reactor = TM::Reactor::factory("epoll");
+    auto            pool    = std::make_shared<TM::ConnectionPool>();
+    ASSERT_EQ(fetch(reactor, server.url(), pool).front(), "hello");
+    std::this_thread::sleep_for(20ms);
+    ASSERT_EQ(fetch(reactor, server.url(), pool).front(), "hello");
+    ASSERT_EQ(server.connections, 2);
+
+    // closed as the request comes. it's retried over a new connection
+    KeepAliveServer racing(KeepAliveServer::OnNextRequest, 1);
+    ASSERT_EQ(fetch(reactor, racing.url(), pool).front(), "hello");
+    ASSERT_EQ(fetch(reactor, racing.url(), pool).front(), "hello");
+    ASSERT_EQ(racing.connections, 2);
+    ASSERT_EQ(racing.requests, 2);
+}
+
+TEST(connectionpool, chunked)
+{
+    // the body ends with the last chunk while the server keeps the connection open
+    KeepAliveServer server(KeepAliveServer::Never, 0, true);
+    auto            reactor = TM::Reactor::factory("epoll");
+    auto            pool    = std::make_shared<TM::ConnectionPool>();
+
+    for (int i = 0; i < 2; i++)
+        ASSERT_EQ(fetch(reactor, server.url(), pool).front(), "hello world");
+    ASSERT_EQ(server.connections, 1);
+    ASSERT_EQ(pool->idleCount(), 1);
+
+    ASSERT_EQ(fetch(reactor, server.url(), nullptr).front(), "hello world");
+    ASSERT_EQ(server.connections, 2);
+}
+
+TEST(connectionpool, destroyed_off_thread)
+{
+    KeepAliveServer server;
+    auto            reactor = TM::Reactor::factory("epoll");
+    auto            pool    = std::make_shared<TM::ConnectionPool>();
+    std::thread     loop([&]() { reactor->start(); });
+
+    std::shared_ptr<TM::HttpClient> client;
+    std::promise<std::string>       result;
+    reactor->post([&]() {
+        client = std::make_shared<TM::HttpClient>(reactor, server.url());
+        client->setConnectionPool(pool);
+        client->execute([&](std::string &&body) { result.set_value(std::move(body)); });
+    });
+    ASSERT_EQ(result.get_future().get(), "hello");
+    std::promise<void> released;
+    reactor->post([&]() {
+        client.reset();
+        released.set_value();
+    });
+    released.get_future().wait();
+    ASSERT_EQ(pool->idleCount(), 1);
+
+    // the connection is closed on its loop, after the pool is gone
+    pool.reset();
+    for (int i = 0; i < 100 && !server.closed; i++)
+        std::this_thread::sleep_for(10ms);
+    ASSERT_EQ(server.closed, 1);
+    reactor->stop();
+    loop.join();
+}
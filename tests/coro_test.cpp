@@ -0,0 +1,141 @@
+#include <arpa/inet.h>
+#include <functional>
+#include <gtest/gtest.h>
+#include <netinet/in.h>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+#include "coro.h"
+#include "httpclient.h"
+#include "reactor.h"
+#include "socket.h"
+
+using namespace std::chrono_literals;
+
+// accepts a single loopback connection and passes it to the handler in a separate thread
+class OneShotServer {
+public:
+    explicit OneShotServer(std::function<void(int)> handler)
+    {
+        _fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr {};
+        addr.sin_family      = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t len        = sizeof(addr);
+        bind(_fd, reinterpret_cast<sockaddr *>(&addr), len);
+        listen(_fd, 1);
+        getsockname(_fd, reinterpret_cast<sockaddr *>(&addr), &len);
+        port    = ntohs(addr.sin_port);
+        _thread = std::thread([this, handler]() {
+            int fd = accept(_fd, nullptr, nullptr);
+            if (fd == -1)
+                return;
+            handler(fd);
+            close(fd);
+        });
+    }
+    ~OneShotServer()
+    {
+        shutdown(_fd, SHUT_RDWR);
+        _thread.join();
+        close(_fd);
+    }
+
+    std::uint16_t port = 0;
+
+private:
+    int         _fd;
+    std::thread _thread;
+};
+
+static TM::Task<int> delayedValue(TM::Reactor &reactor, int value)
+{
+    co_await TM::Delay(reactor, 5ms);
+    co_return value;
+}
+
+static TM::Task<int> failing(TM::Reactor &reactor)
+{
+    co_await TM::Delay(reactor, 1ms);
+    throw std::runtime_error("failed");
+}
+
+TEST(coro, task_chain)
+{
+    auto reactor = TM::Reactor::factory("epoll");
+    int  sum     = 0;
+    bool caught  = false;
+    // the closure has to outlive the coroutine which refers to its captures
+    auto coro = [&]() -> TM::Task<void> {
+        sum += co_await delayedValue(*reactor, 1);
+        sum += co_await delayedValue(*reactor, 2);
+        try {
+            co_await failing(*reactor);
+        } catch (std::runtime_error &) {
+            caught = true;
+        }
+        reactor->stop();
+    };
+    TM::spawn(coro());
+    reactor->start();
+    ASSERT_EQ(sum, 3);
+    ASSERT_TRUE(caught);
+}
+
+TEST(coro, socket_echo)
+{
+    OneShotServer server([](int fd) {
+        char    buf[64];
+        ssize_t n = ::read(fd, buf, sizeof(buf));
+        if (n > 0)
+            ::write(fd, buf, std::size_t(n));
+        // and close right away
+    });
+
+    auto        reactor = TM::Reactor::factory("epoll-et");
+    auto        sock    = std::make_shared<TM::Socket>();
+    std::string echo;
+    bool        connected = false, closed = false;
+    sock->setReactor(reactor);
+    auto coro = [&]() -> TM::Task<void> {
+        connected = co_await sock->asyncConnect("127.0.0.1", server.port);
+        if (connected) {
+            sock->write("ping");
+            std::byte buf[2]; // takes a few reads
+            while (auto n = co_await sock->asyncRead(buf))
+                echo.append(reinterpret_cast<const char *>(buf), n);
+            closed = sock->atEnd();
+            sock->disconnect();
+        }
+        reactor->stop();
+    };
+    TM::spawn(coro());
+    reactor->start();
+    ASSERT_TRUE(connected);
+    ASSERT_EQ(echo, "ping");
+    ASSERT_TRUE(closed);
+}
+
+TEST(coro, http_execute)
+{
+    OneShotServer server([](int fd) {
+        char buf[1024];
+        ::read(fd, buf, sizeof(buf));
+        const char response[] = "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nhello";
+        ::write(fd, response, sizeof(response) - 1);
+    });
+
+    auto        reactor = TM::Reactor::factory("epoll");
+    auto        url     = "http://127.0.0.1:" + std::to_string(server.port);
+    auto        client  = std::make_shared<TM::HttpClient>(reactor, url);
+    std::string body;
+    auto coro = [&]() -> TM::Task<void> {
+        body = co_await client->asyncExecute();
+        reactor->stop();
+    };
+    TM::spawn(coro());
+    reactor->start();
+    ASSERT_EQ(body, "hello");
+}
@@ -0,0 +1,450 @@
+#include <array>
+#include <atomic>
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <mutex>
+#include <set>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+#include "reactor.h"
+#include "reactor_pool.h"
+
+namespace {
+
+class PairDevice : public TM::Device {
+public:
+    PairDevice(bool receivable = false)
+    {
+        int fds[2];
+        socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+        fd   = fds[0];
+        peer = fds[1];
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        setReceivable(receivable);
+    }
+    ~PairDevice() override { close(peer); }
+
+    void on_readyRead() override
+    {
+        auto                        len = read(std::span<std::byte>(buffer));
+        std::lock_guard<std::mutex> lock(mutex);
+        threads.insert(std::this_thread::get_id());
+        received += len;
+        input.append(reinterpret_cast<const char *>(buffer.data()), len);
+        if (onRead)
+            onRead();
+    }
+    void on_readyWrite() override
+    {
+        writes++;
+        if (onWrite)
+            onWrite();
+    }
+
+    int                              peer;
+    std::array<std::byte, ReadBufSz> buffer;
+    std::mutex                       mutex;
+    std::set<std::thread::id>        threads;
+    std::size_t                      received = 0;
+    std::size_t                      writes = 0;
+    std::string                      input;
+    std::function<void()>            onRead;
+    std::function<void()>            onWrite;
+};
+
+} // namespace
+
+class ReactorTest : public ::testing::TestWithParam<const char *> {
+};
+
+INSTANTIATE_TEST_SUITE_P(backends, ReactorTest,
+                         ::testing::Values("epoll", "epoll-et", "epoll-busy", "io_uring",
+                                           "io_uring-sqpoll"));
+
+TEST(reactor, factory)
+{
+    ASSERT_TRUE(TM::Reactor::factory("epoll"));
+    ASSERT_TRUE(TM::Reactor::factory("epoll-et"));
+    ASSERT_TRUE(TM::Reactor::factory("epoll-busy:20"));
+    ASSERT_TRUE(TM::Reactor::factory("io_uring")); // epoll if io_uring isn't supported
+    ASSERT_TRUE(TM::Reactor::factory("pool"));
+    ASSERT_FALSE(TM::Reactor::factory("nonexistent"));
+}
+
+TEST_P(ReactorTest, stop_before_start)
+{
+    auto reactor = TM::Reactor::factory(GetParam());
+    reactor->stop();
+    reactor->start(); // must not hang
+}
+
+TEST_P(ReactorTest, post_from_threads)
+{
+    auto reactor = TM::Reactor::factory(GetParam());
+    auto dev     = std::make_shared<PairDevice>();
+    dev->setReactor(reactor);
+
+    const int                threads = 4, tasks = 10000;
+    std::atomic<bool>        running { false };
+    int                      executed = 0; // only touched on the reactor thread
+    std::vector<std::thread> producers;
+    for (int i = 0; i < threads; i++) {
+        producers.emplace_back([&]() {
+            while (!running)
+                std::this_thread::yield();
+            for (int j = 0; j < tasks; j++)
+                reactor->post([&]() { executed++; });
+        });
+    }
+    std::thread other([&]() {
+        while (!running)
+            std::this_thread::yield();
+        // forwarded to the reactor thread
+        dev->onRead = [&]() { reactor->post([&]() { reactor->stop(); }); };
+        reactor->addDevice(dev);
+        for (auto &t : producers)
+            t.join();
+        ASSERT_EQ(::write(dev->peer, "x", 1), 1);
+    });
+
+    reactor->post([&]() { running = true; });
+    reactor->start();
+    other.join();
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    ASSERT_EQ(dev->received, 1);
+    // all the tasks were posted before the write, so the stop task was the last one
+    ASSERT_EQ(executed, threads * tasks);
+    reactor->removeDevice(dev);
+    dev->setReactor(nullptr);
+}
+
+TEST_P(ReactorTest, post_after_loop_post)
+{
+    // a post from the loop thread must not swallow the wakeup of a later cross-thread one
+    using Clock = std::chrono::steady_clock;
+    auto              reactor = TM::Reactor::factory(GetParam());
+    std::atomic<bool> ready { false };
+    Clock::time_point posted, ran;
+    reactor->post([&]() {
+        reactor->post([]() { });
+        ready = true;
+    });
+    std::thread other([&]() {
+        while (!ready)
+            std::this_thread::yield();
+        std::this_thread::sleep_for(std::chrono::milliseconds(20)); // the loop waits by now
+        posted = Clock::now();
+        reactor->post([&]() {
+            ran = Clock::now();
+            reactor->stop();
+        });
+    });
+    // without the wakeup the task runs only when something else wakes the loop
+    reactor->addTimer(std::chrono::milliseconds(2000), [&]() { reactor->stop(); });
+    reactor->start();
+    other.join();
+    ASSERT_LT(ran - posted, std::chrono::milliseconds(100));
+}
+
+TEST_P(ReactorTest, stats)
+{
+    auto reactor = TM::Reactor::factory(GetParam());
+    auto dev     = std::make_shared<PairDevice>();
+    dev->setReactor(reactor);
+    reactor->addDevice(dev);
+    reactor->setStatsEnabled(true);
+
+    dev->onRead = [&]() { reactor->stop(); };
+    ASSERT_EQ(::write(dev->peer, "x", 1), 1);
+    reactor->start();
+
+    auto stats = reactor->stats();
+#ifdef TM_REACTOR_STATS
+    ASSERT_TRUE(stats.enabled);
+    ASSERT_GE(stats.iterations, 1);
+    ASSERT_GE(stats.events, 1);
+    std::uint64_t callbacks = 0;
+    for (auto c : stats.callbackTime)
+        callbacks += c;
+    ASSERT_EQ(callbacks, 1);
+    ASSERT_EQ(stats.slowest.size(), 1);
+    ASSERT_EQ(stats.slowest[0].description, dev->description());
+#else
+    ASSERT_FALSE(stats.enabled);
+#endif
+    reactor->removeDevice(dev);
+    dev->setReactor(nullptr);
+}
+
+TEST_P(ReactorTest, timers)
+{
+    auto reactor = TM::Reactor::factory(GetParam());
+    auto start   = reactor->now();
+    bool fired   = false;
+    auto id      = reactor->addTimer(std::chrono::milliseconds(5), [&]() { fired = true; });
+    reactor->cancelTimer(id);
+    reactor->addTimer(std::chrono::milliseconds(20), [&]() { reactor->stop(); });
+    reactor->start();
+
+    ASSERT_FALSE(fired);
+    ASSERT_GE((reactor->now() - start).count(), 20);
+}
+
+TEST_P(ReactorTest, timers_from_threads)
+{
+    // scheduled and cancelled on the loop thread while it runs. a cancel from another thread
+    // can't stop a timer which is due already, these are far enough
+    auto              reactor = TM::Reactor::factory(GetParam());
+    std::atomic<bool> ready { false };
+    std::thread::id   firedOn;
+    bool              cancelledFired = false;
+    reactor->post([&]() { ready = true; });
+    std::thread other([&]() {
+        while (!ready)
+            std::this_thread::yield();
+        for (int i = 0; i < 1000; i++)
+            reactor->cancelTimer(reactor->addTimer(std::chrono::milliseconds(20 + i % 3), [&]() {
+                cancelledFired = true;
+            }));
+        reactor->addTimer(std::chrono::milliseconds(50), [&]() {
+            firedOn = std::this_thread::get_id();
+            reactor->stop();
+        });
+    });
+    reactor->start();
+    other.join();
+
+    ASSERT_EQ(firedOn, std::this_thread::get_id());
+    ASSERT_FALSE(cancelledFired);
+}
+
+TEST_P(ReactorTest, write_interest)
+{
+    auto reactor = TM::Reactor::factory(GetParam());
+    auto dev     = std::make_shared<PairDevice>();
+    dev->setReactor(reactor);
+    reactor->addDevice(dev);
+
+    dev->onRead = [&]() {
+        ASSERT_EQ(dev->writes, 0); // writable all the time but nobody asked
+        dev->setWriteInterest(true);
+    };
+    dev->onWrite = [&]() {
+        dev->setWriteInterest(false);
+        ASSERT_EQ(::write(dev->peer, "x", 1), 1);
+        dev->onRead = [&]() { reactor->stop(); };
+    };
+    ASSERT_EQ(::write(dev->peer, "x", 1), 1);
+    reactor->start();
+
+    ASSERT_EQ(dev->received, 2);
+    ASSERT_EQ(dev->writes, 1);
+    reactor->removeDevice(dev);
+    dev->setReactor(nullptr);
+}
+
+TEST_P(ReactorTest, remove_in_callback)
+{
+    auto reactor = TM::Reactor::factory(GetParam());
+    auto dev     = std::make_shared<PairDevice>();
+    dev->setReactor(reactor);
+    dev->setWriteInterest(true);
+    reactor->addDevice(dev);
+
+    // readable and writable at once. the write event must not reach the removed device
+    int writes  = 0;
+    dev->onRead = [&]() {
+        reactor->removeDevice(dev);
+        dev.reset(); // kept alive by the reactor till the end of the iteration
+        reactor->addTimer(std::chrono::milliseconds(10), [&]() { reactor->stop(); });
+    };
+    dev->onWrite = [&]() { writes++; };
+    ASSERT_EQ(::write(dev->peer, "x", 1), 1);
+    reactor->start();
+    ASSERT_FALSE(dev);
+    ASSERT_EQ(writes, 0);
+}
+
+TEST_P(ReactorTest, drains_input)
+{
+    auto reactor = TM::Reactor::factory(GetParam());
+    auto dev     = std::make_shared<PairDevice>();
+    dev->setReactor(reactor);
+    reactor->addDevice(dev);
+
+    std::string data(TM::Device::ReadBufSz * 3 + 10, 'x');
+    dev->onRead = [&]() {
+        if (dev->received == data.size())
+            reactor->stop();
+    };
+    ASSERT_EQ(::write(dev->peer, data.data(), data.size()), data.size());
+    reactor->start();
+
+    ASSERT_EQ(dev->received, data.size());
+    reactor->removeDevice(dev);
+    dev->setReactor(nullptr);
+}
+
+TEST_P(ReactorTest, received_input)
+{
+    // io_uring reads it into its buffers. more than they hold and than a device keeps unread
+    auto reactor = TM::Reactor::factory(GetParam());
+    auto dev     = std::make_shared<PairDevice>(true);
+    dev->setReactor(reactor);
+    reactor->addDevice(dev);
+
+    std::string data;
+    for (int i = 0; data.size() < 512 * 1024; i++)
+        data += std::to_string(i) + ',';
+    std::thread writer([&]() {
+        for (std::size_t sent = 0; sent < data.size();) {
+            auto n = ::write(dev->peer, data.data() + sent, data.size() - sent);
+            ASSERT_GT(n, 0);
+            sent += std::size_t(n);
+        }
+        ::shutdown(dev->peer, SHUT_WR);
+    });
+    dev->onRead = [&]() {
+        if (dev->atEnd())
+            reactor->stop();
+    };
+    reactor->start();
+    writer.join();
+
+    ASSERT_EQ(dev->input, data);
+    reactor->removeDevice(dev);
+    dev->setReactor(nullptr);
+}
+
+TEST(device, read_into_span)
+{
+    PairDevice dev;
+    std::string data(100, 'x');
+    ASSERT_EQ(::write(dev.peer, data.data(), data.size()), data.size());
+    ASSERT_EQ(dev.bytesAvailable(), 100);
+
+    std::array<std::byte, 64> buf;
+    ASSERT_EQ(dev.read(std::span<std::byte>(buf)), 64);
+    ASSERT_EQ(dev.bytesAvailable(), 36);
+    ASSERT_EQ(dev.read(std::span<std::byte>(buf)), 36);
+    ASSERT_EQ(dev.read(std::span<std::byte>(buf)), 0);
+    ASSERT_FALSE(dev.atEnd());
+
+    // sized by what's available, not by the requested maximum
+    ASSERT_EQ(::write(dev.peer, data.data(), 10), 10);
+    ASSERT_EQ(dev.read(1 << 20).size(), 10);
+
+    ::shutdown(dev.peer, SHUT_WR);
+    ASSERT_EQ(dev.read(std::span<std::byte>(buf)), 0);
+    ASSERT_TRUE(dev.atEnd());
+}
+
+TEST(device, queued_write)
+{
+    PairDevice dev;
+    dev.setWriteWatermarks(1024, 64 * 1024);
+
+    // gathered into one writev while the socket takes it
+    std::string_view parts[] = { "GET /a\r\n\r\n", "GET /b\r\n\r\n" };
+    ASSERT_EQ(dev.write(std::span<const std::string_view>(parts)), 20);
+    ASSERT_EQ(dev.bytesToWrite(), 0);
+    char buf[65536];
+    ASSERT_EQ(::read(dev.peer, buf, sizeof(buf)), 20);
+    ASSERT_EQ(std::string(buf, 20), "GET /a\r\n\r\nGET /b\r\n\r\n");
+
+    // much more than the socket buffer. the rest is queued instead of being lost
+    std::string data(1 << 20, 'x');
+    for (std::size_t i = 0; i < data.size(); i++)
+        data[i] = char('a' + i % 26);
+    ASSERT_EQ(dev.write(data), data.size());
+    ASSERT_GT(dev.bytesToWrite(), 0);
+    ASSERT_TRUE(dev.writeBufferFull());
+    ASSERT_TRUE(dev.writeInterest());
+
+    std::string received;
+    while (received.size() < data.size()) {
+        auto len = ::read(dev.peer, buf, sizeof(buf));
+        ASSERT_GT(len, 0);
+        received.append(buf, std::size_t(len));
+        dev.dispatchWrite(); // as the reactor does on writability
+    }
+    ASSERT_EQ(received, data);
+    ASSERT_EQ(dev.bytesToWrite(), 0);
+    ASSERT_FALSE(dev.writeInterest());
+    ASSERT_EQ(dev.writes, 1); // once drained to the low watermark
+}
+
+TEST(reactor, pool_shards_devices)
+{
+    auto pool = std::make_shared<TM::ReactorPool>(2, TM::ReactorPool::RoundRobin);
+
+    std::vector<std::shared_ptr<PairDevice>> devices;
+    std::atomic<int>                         done { 0 };
+    for (int i = 0; i < 4; i++) {
+        auto dev = std::make_shared<PairDevice>();
+        dev->setReactor(pool);
+        dev->onRead = [&, dev = dev.get()]() {
+            if (dev->received == 6 && ++done == 4)
+                pool->stop();
+        };
+        pool->addDevice(dev);
+        devices.push_back(dev);
+    }
+
+    std::thread writer([&]() {
+        for (auto &dev : devices) {
+            ASSERT_EQ(::write(dev->peer, "abc", 3), 3);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        for (auto &dev : devices) {
+            ASSERT_EQ(::write(dev->peer, "def", 3), 3);
+        }
+    });
+    pool->start();
+    writer.join();
+
+    std::set<std::thread::id> allThreads;
+    for (auto &dev : devices) {
+        ASSERT_EQ(dev->received, 6);
+        ASSERT_EQ(dev->threads.size(), 1); // always called on the owning thread
+        allThreads.insert(*dev->threads.begin());
+        dev->setReactor(nullptr);
+    }
+    ASSERT_EQ(allThreads.size(), 2);
+}
+
+TEST(reactor, pool_timers)
+{
+    // added from outside while the loops run. each goes to its loop through a posted task
+    auto pool = std::make_shared<TM::ReactorPool>(2, TM::ReactorPool::RoundRobin);
+    std::mutex                mutex;
+    std::set<std::thread::id> threads;
+    std::atomic<int>          running { 0 };
+    std::atomic<int>          fired { 0 };
+    std::atomic<bool>         cancelledFired { false };
+    for (int i = 0; i < 2; i++)
+        pool->post([&]() { running++; });
+    std::thread loops([&]() { pool->start(); });
+    while (running < 2)
+        std::this_thread::yield();
+
+    for (int i = 0; i < 4; i++)
+        pool->cancelTimer(pool->addTimer(std::chrono::milliseconds(20), [&]() {
+            cancelledFired = true;
+        }));
+    for (int i = 0; i < 4; i++)
+        pool->addTimer(std::chrono::milliseconds(50), [&]() {
+            std::lock_guard<std::mutex> lock(mutex);
+            threads.insert(std::this_thread::get_id());
+            if (++fired == 4)
+                pool->stop();
+        });
+    loops.join();
+
+    ASSERT_EQ(fired, 4);
+    ASSERT_EQ(threads.size(), 2);
+    ASSERT_FALSE(cancelledFired);
+}
@@ -0,0 +1,174 @@
+#include <cstdio>
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include "httpclient.h"
+#include "reactor_sim.h"
+
+using namespace std::chrono_literals;
+
+struct FetchResult {
+    std::string               body;
+    std::chrono::milliseconds finished { -1 };
+};
+
+static FetchResult fetch(std::shared_ptr<TM::ReactorSim> sim, const std::string &url,
+                         std::chrono::milliseconds timeout = 0ms)
+{
+    FetchResult result;
+    auto        client = std::make_shared<TM::HttpClient>(sim, url);
+    client->setConnector(sim->connector());
+    client->setTimeout(timeout);
+    client->execute([&](std::string &&body) {
+        result.body     = std::move(body);
+        result.finished = sim->now();
+        sim->stop();
+    });
+    sim->start();
+    return result;
+}
+
+// replies to the first request with the body and optionally resets in the middle of it
+static void serve(TM::ReactorSim &sim, const std::string &body, TM::ReactorSim::Link link,
+                  std::size_t resetAfter = std::string::npos)
+{
+    sim.listen("example.com", 80,
+               [body, resetAfter, request = std::string()](TM::ReactorSim::Connection &conn,
+                                                          std::string &&data) mutable {
+                   request += data;
+                   if (data.empty() || request.find("\r\n\r\n") == std::string::npos)
+                       return;
+                   auto response = "HTTP/1.1 200 OK\r\nContent-Length: "
+                       + std::to_string(body.size()) + "\r\n\r\n" + body;
+                   if (resetAfter < response.size()) {
+                       conn.send(response.substr(0, resetAfter));
+                       conn.reset();
+                   } else {
+                       conn.send(response);
+                       conn.close();
+                   }
+               },
+               link);
+}
+
+TEST(reactorsim, virtual_time)
+{
+    auto             sim = std::make_shared<TM::ReactorSim>();
+    std::vector<int> fired;
+    sim->addTimer(1h, [&]() { fired.push_back(3); });
+    sim->addTimer(1s, [&]() { fired.push_back(1); });
+    sim->addTimer(2min, [&]() {
+        fired.push_back(2);
+        ASSERT_EQ(sim->now(), 2min);
+    });
+
+    auto started = std::chrono::steady_clock::now();
+    sim->start(); // stops by itself when there is nothing left to do
+    ASSERT_LT(std::chrono::steady_clock::now() - started, 1s);
+    ASSERT_EQ(fired, std::vector<int>({ 1, 2, 3 }));
+    ASSERT_EQ(sim->now(), 1h);
+}
+
+TEST(reactorsim, slow_link)
+{
+    std::string          body(20000, 'x');
+    TM::ReactorSim::Link link;
+    link.latency    = 40ms;
+    link.bandwidth  = 100000;
+    link.maxSegment = 1400;
+
+    FetchResult first;
+    for (int i = 0; i < 2; i++) {
+        auto sim = std::make_shared<TM::ReactorSim>();
+        serve(*sim, body, link);
+        auto result = fetch(sim, "http://example.com/");
+        ASSERT_EQ(result.body, body);
+        // request and response latency plus 200ms to transmit the body
+        ASSERT_GE(result.finished, 280ms);
+        ASSERT_LT(result.finished, 300ms);
+        if (i == 0)
+            first = result;
+        else
+            ASSERT_EQ(result.finished, first.finished); // deterministic
+    }
+}
+
+TEST(reactorsim, timeout)
+{
+    auto sim = std::make_shared<TM::ReactorSim>();
+    sim->listen("example.com", 80, [](TM::ReactorSim::Connection &, std::string &&) { });
+    auto result = fetch(sim, "http://example.com/", 30s);
+    ASSERT_TRUE(result.body.empty());
+    ASSERT_EQ(result.finished, 30s);
+}
+
+TEST(reactorsim, reset)
+{
+    auto                 sim = std::make_shared<TM::ReactorSim>();
+    TM::ReactorSim::Link link;
+    link.latency = 10ms;
+    serve(*sim, std::string(1000, 'x'), link, 100);
+    auto result = fetch(sim, "http://example.com/", 30s);
+    ASSERT_TRUE(result.body.empty());
+    ASSERT_EQ(result.finished, 20ms);
+}
+
+TEST(reactorsim, refused)
+{
+    auto sim    = std::make_shared<TM::ReactorSim>();
+    auto result = fetch(sim, "http://example.com/");
+    ASSERT_TRUE(result.body.empty());
+    ASSERT_EQ(result.finished, 0ms);
+}
+
+TEST(reactorsim, body_in_one_block)
+{
+    auto                 sim = std::make_shared<TM::ReactorSim>();
+    TM::ReactorSim::Link link;
+    link.maxSegment = 1400; // many partial reads
+    std::string body(100000, 'x');
+    serve(*sim, body, link);
+
+    TM::BufferChain received;
+    auto            client = std::make_shared<TM::HttpClient>(sim, "http://example.com/");
+    client->setConnector(sim->connector());
+    client->execute([&](TM::BufferChain &&data) {
+        received = std::move(data);
+        sim->stop();
+    });
+    sim->start();
+    // the content length is known, so the reads went one after another into the same block
+    ASSERT_EQ(received.slices().size(), 1);
+    ASSERT_EQ(received.contiguous(), body);
+}
+
+TEST(reactorsim, archive_to_file)
+{
+    auto                 sim = std::make_shared<TM::ReactorSim>();
+    TM::ReactorSim::Link link;
+    link.maxSegment = 1400;
+    std::string body(100000, 'x');
+    for (std::size_t i = 0; i < body.size(); i++)
+        body[i] = char('a' + i % 26);
+    serve(*sim, body, link);
+
+    auto file   = std::tmpfile();
+    auto client = std::make_shared<TM::HttpClient>(sim, "http://example.com/");
+    client->setConnector(sim->connector());
+    client->setOutput(fileno(file));
+    std::size_t received = 1;
+    client->execute([&](TM::BufferChain &&data) {
+        received = data.size();
+        sim->stop();
+    });
+    sim->start();
+    ASSERT_TRUE(client->completed());
+    ASSERT_EQ(received, 0);
+    ASSERT_EQ(client->bodyWritten(), body.size());
+
+    std::string stored(body.size() + 1, '\0');
+    ASSERT_EQ(pread(fileno(file), stored.data(), stored.size(), 0), body.size());
+    stored.resize(body.size());
+    ASSERT_EQ(stored, body);
+    std::fclose(file);
+}
@@ -0,0 +1,111 @@
+#include <arpa/inet.h>
+#include <atomic>
+#include <gtest/gtest.h>
+#include <thread>
+
+#include "reactor.h"
+#include "resolver.h"
+
+using namespace std::chrono_literals;
+
+static TM::Resolver::Addresses address(const char *ip)
+{
+    sockaddr_storage addr {};
+    auto             sin = reinterpret_cast<sockaddr_in *>(&addr);
+    sin->sin_family      = AF_INET;
+    inet_pton(AF_INET, ip, &sin->sin_addr);
+    return { addr };
+}
+
+TEST(resolver, coalesces_and_caches)
+{
+    std::atomic<int> lookups { 0 };
+    TM::Resolver     resolver(2, [&](const std::string &, std::chrono::seconds &ttl) {
+        lookups++;
+        std::this_thread::sleep_for(20ms);
+        ttl = 30s;
+        return address("10.0.0.1");
+    });
+
+    auto reactor  = TM::Reactor::factory("epoll");
+    int  answered = 0;
+    bool cached   = false;
+    auto callback = [&](const TM::Resolver::Addresses &addresses) {
+        ASSERT_EQ(addresses.size(), 1u);
+        if (++answered == 2) {
+            resolver.resolve(reactor, "example.com",
+                             [&](const TM::Resolver::Addresses &) { cached = true; });
+            ASSERT_TRUE(cached); // answered synchronously from the cache
+            reactor->stop();
+        }
+    };
+    resolver.resolve(reactor, "example.com", callback);
+    resolver.resolve(reactor, "example.com", callback);
+    reactor->start();
+    ASSERT_EQ(answered, 2);
+    ASSERT_EQ(lookups, 1);
+}
+
+TEST(resolver, ttl)
+{
+    std::atomic<int> lookups { 0 };
+    TM::Resolver     resolver(1, [&](const std::string &host, std::chrono::seconds &ttl) {
+        lookups++;
+        ttl = 0s; // don't cache
+        return host == "bad" ? TM::Resolver::Addresses() : address("10.0.0.1");
+    });
+    resolver.setTtl(60s, 60s);
+
+    auto reactor = TM::Reactor::factory("epoll");
+    int  step    = 0;
+    std::function<void(const TM::Resolver::Addresses &)> next;
+    next = [&](const TM::Resolver::Addresses &) {
+        switch (++step) {
+        case 1:
+            resolver.resolve(reactor, "good", next); // ttl 0 is honored, so it's another lookup
+            break;
+        case 2:
+            resolver.resolve(reactor, "bad", next);
+            break;
+        case 3:
+            resolver.resolve(reactor, "bad", next); // failures are cached for the negative ttl
+            ASSERT_EQ(step, 4);
+            reactor->stop();
+            break;
+        }
+    };
+    resolver.resolve(reactor, "good", next);
+    reactor->start();
+    ASSERT_EQ(lookups, 3);
+}
+
+TEST(resolver, numeric)
+{
+    TM::Resolver resolver(1, [](const std::string &, std::chrono::seconds &) {
+        ADD_FAILURE() << "numeric addresses don't need lookups";
+        return TM::Resolver::Addresses();
+    });
+    bool answered = false;
+    resolver.resolve(TM::Reactor::factory("epoll"), "127.0.0.1",
+                     [&](const TM::Resolver::Addresses &addresses) {
+                         answered = addresses.size() == 1;
+                     });
+    ASSERT_TRUE(answered);
+}
+
+TEST(resolver, hosts_file)
+{
+    // answered by getaddrinfo from /etc/hosts. no dns query, so an unreachable nameserver
+    // doesn't delay it
+    TM::Resolver resolver(1);
+    auto         reactor = TM::Reactor::factory("epoll");
+    std::size_t  count   = 0;
+    auto         started = std::chrono::steady_clock::now();
+    resolver.resolve(reactor, "localhost", [&](const TM::Resolver::Addresses &addresses) {
+        count = addresses.size();
+        reactor->stop();
+    });
+    reactor->start();
+    ASSERT_GT(count, 0u);
+    ASSERT_LT(std::chrono::steady_clock::now() - started, 1s);
+}
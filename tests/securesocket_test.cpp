@@ -0,0 +1,306 @@
+#include <arpa/inet.h>
+#include <atomic>
+#include <csignal>
+#include <gtest/gtest.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+
+#include "connectionpool.h"
+#include "httpclient.h"
+#include "reactor.h"
+#include "securesocket.h"
+#include "tlscontext.h"
+#include "workerpool.h"
+
+// loopback https server with a self-signed certificate. answers every request with "hello".
+// with keepAlive a connection serves requests till the client closes it
+class TlsServer {
+public:
+    enum EarlyData { NoEarlyData, AcceptEarlyData, RejectEarlyData };
+
+    TlsServer(EarlyData earlyData = NoEarlyData, bool keepAlive = false) :
+        _earlyData(earlyData), _keepAlive(keepAlive)
+    {
+        // clients may leave right after the handshake, before the response is written
+        signal(SIGPIPE, SIG_IGN);
+        _ctx = SSL_CTX_new(TLS_server_method());
+        useSelfSigned();
+        // the tickets allow 0-rtt. without SSL_read_early_data it's rejected though
+        if (earlyData != NoEarlyData)
+            SSL_CTX_set_max_early_data(_ctx, 16384);
+
+        _fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr {};
+        addr.sin_family      = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t len        = sizeof(addr);
+        bind(_fd, reinterpret_cast<sockaddr *>(&addr), len);
+        listen(_fd, 16);
+        getsockname(_fd, reinterpret_cast<sockaddr *>(&addr), &len);
+        port    = ntohs(addr.sin_port);
+        _thread = std::thread([this]() { run(); });
+    }
+    ~TlsServer()
+    {
+        shutdown(_fd, SHUT_RDWR);
+        _thread.join();
+        close(_fd);
+        SSL_CTX_free(_ctx);
+    }
+
+    std::string url() const { return "https://127.0.0.1:" + std::to_string(port) + "/"; }
+
+    std::uint16_t    port = 0;
+    std::atomic<int> handshakes { 0 };
+    std::atomic<int> resumed { 0 };
+    std::atomic<int> earlyRequests { 0 }; // came as accepted early data
+    std::atomic<int> requests { 0 };      // answered in keep-alive mode
+
+private:
+    void useSelfSigned()
+    {
+        EVP_PKEY *key  = nullptr;
+        auto      pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr);
+        EVP_PKEY_keygen_init(pctx);
+        EVP_PKEY_CTX_set_ec_paramgen_curve_nid(pctx, NID_X9_62_prime256v1);
+        EVP_PKEY_keygen(pctx, &key);
+        EVP_PKEY_CTX_free(pctx);
+
+        X509 *cert = X509_new();
+        ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+        X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+        X509_gmtime_adj(X509_getm_notAfter(cert), 3600);
+        X509_set_pubkey(cert, key);
+        auto name = X509_get_subject_name(cert);
+        X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+                                   reinterpret_cast<const unsigned char *>("localhost"), -1, -1, 0);
+        X509_set_issuer_name(cert, name);
+        X509_sign(cert, key, EVP_sha256());
+        SSL_CTX_use_certificate(_ctx, cert);
+        SSL_CTX_use_PrivateKey(_ctx, key);
+        X509_free(cert);
+        EVP_PKEY_free(key);
+    }
+
+    void run()
+    {
+        int fd;
+        while ((fd = accept(_fd, nullptr, nullptr)) != -1) {
+            SSL *ssl = SSL_new(_ctx);
+            SSL_set_fd(ssl, fd);
+            std::string request;
+            char        buf[1024];
+            if (_earlyData == AcceptEarlyData) {
+                std::size_t len;
+                while (SSL_read_early_data(ssl, buf, sizeof(buf), &len)
+                       == SSL_READ_EARLY_DATA_SUCCESS)
+                    request.append(buf, len);
+            }
+            if (SSL_accept(ssl) == 1) {
+                handshakes++;
+                if (SSL_session_reused(ssl))
+                    resumed++;
+                if (SSL_get_early_data_status(ssl) == SSL_EARLY_DATA_ACCEPTED && !request.empty())
+                    earlyRequests++;
+                int n;
+                while (true) {
+                    while (request.find("\r\n\r\n") == std::string::npos
+                           && (n = SSL_read(ssl, buf, sizeof(buf))) > 0)
+                        request.append(buf, std::size_t(n));
+                    if (_keepAlive && request.find("\r\n\r\n") == std::string::npos)
+                        break;
+                    const char response[] = "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nhello";
+                    SSL_write(ssl, response, sizeof(response) - 1);
+                    if (!_keepAlive)
+                        break;
+                    requests++;
+                    request.clear();
+                }
+                SSL_shutdown(ssl);
+            }
+            SSL_free(ssl);
+            close(fd);
+        }
+    }
+
+    EarlyData   _earlyData;
+    bool        _keepAlive;
+    SSL_CTX *   _ctx;
+    int         _fd;
+    std::thread _thread;
+};
+
+static std::string fetch(const std::string &url, std::shared_ptr<TM::TlsContext> context,
+                         bool earlyData = false)
+{
+    auto        reactor = TM::Reactor::factory("epoll");
+    auto        client  = std::make_shared<TM::HttpClient>(reactor, url);
+    std::string result;
+    client->setTlsContext(context);
+    client->setEarlyData(earlyData);
+    client->execute([&](std::string &&body) {
+        result = std::move(body);
+        reactor->stop();
+    });
+    reactor->start();
+    return result;
+}
+
+TEST(securesocket, session_resumption)
+{
+    TlsServer server;
+    auto      context = std::make_shared<TM::TlsContext>();
+
+    ASSERT_EQ(fetch(server.url(), context), "hello");
+    ASSERT_EQ(server.resumed, 0);
+    ASSERT_GE(context->sessionCount(), 1);
+
+    ASSERT_EQ(fetch(server.url(), context), "hello");
+    ASSERT_EQ(server.handshakes, 2);
+    ASSERT_EQ(server.resumed, 1);
+
+    // another context has sessions of its own
+    ASSERT_EQ(fetch(server.url(), std::make_shared<TM::TlsContext>()), "hello");
+    ASSERT_EQ(server.resumed, 1);
+}
+
+TEST(securesocket, async_handshake)
+{
+    // accepts tcp connections (by the backlog) but never answers the handshake
+    int         stalled = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr {};
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len        = sizeof(addr);
+    bind(stalled, reinterpret_cast<sockaddr *>(&addr), len);
+    listen(stalled, 16);
+    getsockname(stalled, reinterpret_cast<sockaddr *>(&addr), &len);
+
+    TlsServer server;
+    auto      reactor = TM::Reactor::factory("epoll");
+    auto      context = std::make_shared<TM::TlsContext>();
+
+    std::vector<std::shared_ptr<TM::SecureSocket>> hanging;
+    for (int i = 0; i < 10; i++) {
+        auto sock = std::make_shared<TM::SecureSocket>();
+        sock->setReactor(reactor);
+        sock->setTlsContext(context);
+        sock->connect("127.0.0.1", ntohs(addr.sin_port));
+        hanging.push_back(sock);
+    }
+
+    // completes on the same thread while the others wait for the server
+    auto good      = std::make_shared<TM::SecureSocket>();
+    bool connected = false;
+    good->setReactor(reactor);
+    good->setTlsContext(context);
+    good->setConnectedCallback([&]() {
+        connected = true;
+        reactor->stop();
+    });
+    good->setDisconnectedCallback([&]() { reactor->stop(); });
+    good->connect("127.0.0.1", server.port);
+    reactor->start();
+
+    ASSERT_TRUE(connected);
+    ASSERT_FALSE(good->handshaking());
+    ASSERT_GT(good->handshakeTime().count(), 0);
+    for (auto &sock : hanging) {
+        ASSERT_TRUE(sock->handshaking());
+        sock->disconnect();
+    }
+    good->disconnect();
+    close(stalled);
+}
+
+TEST(securesocket, kernel_tls)
+{
+    // falls back to user space crypto where the kernel has no tls support
+    TlsServer              server;
+    TM::TlsContext::Config config;
+    config.kernelTls = true;
+    ASSERT_EQ(fetch(server.url(), std::make_shared<TM::TlsContext>(config)), "hello");
+}
+
+TEST(securesocket, early_data)
+{
+    TlsServer server(TlsServer::AcceptEarlyData);
+    auto      context = std::make_shared<TM::TlsContext>();
+
+    // nothing to resume yet
+    ASSERT_EQ(fetch(server.url(), context, true), "hello");
+    ASSERT_EQ(server.earlyRequests, 0);
+
+    ASSERT_EQ(fetch(server.url(), context, true), "hello");
+    ASSERT_EQ(server.resumed, 1);
+    ASSERT_EQ(server.earlyRequests, 1);
+
+    // the request is sent again after the handshake
+    TlsServer rejecting(TlsServer::RejectEarlyData);
+    ASSERT_EQ(fetch(rejecting.url(), context, true), "hello");
+    ASSERT_EQ(fetch(rejecting.url(), context, true), "hello");
+    ASSERT_EQ(rejecting.resumed, 1);
+    ASSERT_EQ(rejecting.earlyRequests, 0);
+}
+
+TEST(securesocket, offloaded_handshake)
+{
+    TlsServer              server;
+    TM::TlsContext::Config config;
+    config.handshakeWorkers = std::make_shared<TM::WorkerPool>(2);
+    auto context            = std::make_shared<TM::TlsContext>(config);
+
+    // a burst of connections on one reactor
+    auto                                         reactor = TM::Reactor::factory("epoll");
+    std::vector<std::shared_ptr<TM::HttpClient>> clients;
+    std::vector<std::string>                     results(8);
+    int                                          pending = int(results.size());
+    for (std::size_t i = 0; i < results.size(); i++) {
+        auto client = std::make_shared<TM::HttpClient>(reactor, server.url());
+        client->setTlsContext(context);
+        client->execute([&, i](std::string &&body) {
+            results[i] = std::move(body);
+            if (!--pending)
+                reactor->stop();
+        });
+        clients.push_back(client);
+    }
+    reactor->start();
+
+    for (auto const &result : results)
+        ASSERT_EQ(result, "hello");
+    ASSERT_EQ(server.handshakes, int(results.size()));
+
+    // resumption works the same
+    ASSERT_EQ(fetch(server.url(), context), "hello");
+    ASSERT_GE(server.resumed, 1);
+}
+
+TEST(securesocket, keep_alive)
+{
+    TlsServer server(TlsServer::NoEarlyData, true);
+    auto      context = std::make_shared<TM::TlsContext>();
+    auto      pool    = std::make_shared<TM::ConnectionPool>();
+    auto      reactor = TM::Reactor::factory("epoll");
+
+    for (int i = 0; i < 3; i++) {
+        auto        client = std::make_shared<TM::HttpClient>(reactor, server.url());
+        std::string result;
+        client->setTlsContext(context);
+        client->setConnectionPool(pool);
+        client->execute([&](std::string &&body) {
+            result = std::move(body);
+            reactor->stop();
+        });
+        reactor->start();
+        ASSERT_EQ(result, "hello");
+    }
+    ASSERT_EQ(server.handshakes, 1);
+    ASSERT_EQ(server.requests, 3);
+    pool->clear(); // the server serves one connection at a time
+}
@@ -0,0 +1,217 @@
+#include <arpa/inet.h>
+#include <gtest/gtest.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "reactor.h"
+#include "resolver.h"
+#include "socket.h"
+
+using namespace std::chrono_literals;
+
+// listening loopback socket. the kernel completes handshakes without accept()
+static int listenLoopback(std::uint16_t &port, int backlog = 16, const char *ip = "127.0.0.1")
+{
+    int         fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr {};
+    addr.sin_family = AF_INET;
+    addr.sin_port   = htons(port);
+    inet_pton(AF_INET, ip, &addr.sin_addr);
+    socklen_t len = sizeof(addr);
+    bind(fd, reinterpret_cast<sockaddr *>(&addr), len);
+    listen(fd, backlog);
+    getsockname(fd, reinterpret_cast<sockaddr *>(&addr), &len);
+    port = ntohs(addr.sin_port);
+    return fd;
+}
+
+static sockaddr_storage address(const char *ip)
+{
+    sockaddr_storage addr {};
+    auto             sin = reinterpret_cast<sockaddr_in *>(&addr);
+    sin->sin_family      = AF_INET;
+    inet_pton(AF_INET, ip, &sin->sin_addr);
+    return addr;
+}
+
+// connects to the host and returns the connected ip and time it took
+static std::pair<std::string, std::chrono::milliseconds>
+connectTo(const std::string &host, std::uint16_t port, const std::string &reactorName = "epoll")
+{
+    auto        reactor = TM::Reactor::factory(reactorName);
+    auto        sock    = std::make_shared<TM::Socket>();
+    std::string peer;
+    auto        started = reactor->now();
+    sock->setReactor(reactor);
+    sock->setConnectedCallback([&]() {
+        sockaddr_storage addr;
+        socklen_t        len = sizeof(addr);
+        char             ip[INET6_ADDRSTRLEN];
+        getpeername(sock->fileDescriptor(), reinterpret_cast<sockaddr *>(&addr), &len);
+        if (addr.ss_family == AF_INET6)
+            peer = inet_ntop(AF_INET6, &reinterpret_cast<sockaddr_in6 *>(&addr)->sin6_addr, ip,
+                             sizeof(ip));
+        else
+            peer = inet_ntop(AF_INET, &reinterpret_cast<sockaddr_in *>(&addr)->sin_addr, ip,
+                             sizeof(ip));
+        reactor->stop();
+    });
+    sock->setDisconnectedCallback([&]() { reactor->stop(); });
+    sock->connect(host, port);
+    reactor->start();
+    sock->disconnect();
+    return { peer, reactor->now() - started };
+}
+
+TEST(socket, parallel_connects)
+{
+    std::uint16_t port = 0;
+    int           listenFd = listenLoopback(port);
+    auto          reactor  = TM::Reactor::factory("epoll");
+
+    const int                                count     = 10;
+    int                                      connected = 0;
+    std::vector<std::shared_ptr<TM::Socket>> sockets;
+    for (int i = 0; i < count; i++) {
+        auto sock = std::make_shared<TM::Socket>();
+        sock->setReactor(reactor);
+        sock->setConnectedCallback([&]() {
+            if (++connected == count)
+                reactor->stop();
+        });
+        sock->setDisconnectedCallback([&]() { reactor->stop(); });
+        sock->connect("localhost", port); // one lookup shared by all the sockets
+        sockets.push_back(sock);
+    }
+    ASSERT_EQ(connected, 0); // completed by the reactor, not inside connect()
+    reactor->start();
+    ASSERT_EQ(connected, count);
+    for (auto &sock : sockets)
+        sock->disconnect();
+    close(listenFd);
+}
+
+TEST(socket, connect_refused)
+{
+    std::uint16_t port = 0;
+    close(listenLoopback(port)); // nobody listens there anymore
+
+    auto reactor      = TM::Reactor::factory("epoll");
+    auto sock         = std::make_shared<TM::Socket>();
+    bool connected    = false;
+    bool disconnected = false;
+    sock->setReactor(reactor);
+    sock->setConnectedCallback([&]() { connected = true; });
+    sock->setDisconnectedCallback([&]() {
+        disconnected = true;
+        reactor->stop();
+    });
+    sock->connect("127.0.0.1", port);
+    reactor->start();
+    ASSERT_FALSE(connected);
+    ASSERT_TRUE(disconnected);
+    ASSERT_EQ(sock->fileDescriptor(), -1);
+}
+
+TEST(socket, happy_eyeballs_stalled)
+{
+    // the first address accepts no more connections and its handshakes hang
+    std::uint16_t port    = 0;
+    int           good    = listenLoopback(port);
+    int           stalled = listenLoopback(port, 0, "127.0.0.2");
+    int           filler  = socket(AF_INET, SOCK_STREAM, 0);
+    auto          addr    = address("127.0.0.2");
+    reinterpret_cast<sockaddr_in *>(&addr)->sin_port = htons(port);
+    ::connect(filler, reinterpret_cast<sockaddr *>(&addr), sizeof(sockaddr_in));
+
+    TM::Resolver::instance().pin("stalled.test", { address("127.0.0.2"), address("127.0.0.1") });
+    auto [peer, spent] = connectTo("stalled.test", port);
+    ASSERT_EQ(peer, "127.0.0.1");
+    ASSERT_GE(spent, 250ms); // the second attempt starts after the delay
+    ASSERT_LT(spent, 1s);
+    close(filler);
+    close(stalled);
+    close(good);
+}
+
+TEST(socket, happy_eyeballs_pool)
+{
+    // the attempts, the delay timer and the socket share one loop of the pool
+    std::uint16_t port    = 0;
+    int           good    = listenLoopback(port);
+    int           stalled = listenLoopback(port, 0, "127.0.0.2");
+    int           filler  = socket(AF_INET, SOCK_STREAM, 0);
+    auto          addr    = address("127.0.0.2");
+    reinterpret_cast<sockaddr_in *>(&addr)->sin_port = htons(port);
+    ::connect(filler, reinterpret_cast<sockaddr *>(&addr), sizeof(sockaddr_in));
+
+    TM::Resolver::instance().pin("pool.test", { address("127.0.0.2"), address("127.0.0.1") });
+    auto [peer, spent] = connectTo("pool.test", port, "pool");
+    ASSERT_EQ(peer, "127.0.0.1");
+    ASSERT_GE(spent, 250ms);
+    close(filler);
+    close(stalled);
+    close(good);
+}
+
+TEST(socket, happy_eyeballs_refused)
+{
+    std::uint16_t port = 0;
+    int           good = listenLoopback(port);
+
+    TM::Resolver::instance().pin("refused.test", { address("127.0.0.2"), address("127.0.0.1") });
+    auto [peer, spent] = connectTo("refused.test", port);
+    ASSERT_EQ(peer, "127.0.0.1");
+    ASSERT_LT(spent, 250ms); // no need to wait once the first one failed
+    close(good);
+}
+
+TEST(socket, options)
+{
+    std::uint16_t port     = 0;
+    int           listenFd = listenLoopback(port);
+    auto          reactor  = TM::Reactor::factory("epoll");
+    auto          sock     = std::make_shared<TM::Socket>();
+
+    TM::SocketOptions options;
+    options.noDelay     = true;
+    options.userTimeout = 3s;
+    sock->setOptions(options);
+    sock->setReactor(reactor);
+
+    int noDelay = 0, userTimeout = 0;
+    sock->setConnectedCallback([&]() {
+        socklen_t len = sizeof(int);
+        getsockopt(sock->fileDescriptor(), IPPROTO_TCP, TCP_NODELAY, &noDelay, &len);
+        getsockopt(sock->fileDescriptor(), IPPROTO_TCP, TCP_USER_TIMEOUT, &userTimeout, &len);
+        reactor->stop();
+    });
+    sock->setDisconnectedCallback([&]() { reactor->stop(); });
+    sock->connect("127.0.0.1", port);
+    reactor->start();
+    ASSERT_EQ(noDelay, 1);
+    ASSERT_EQ(userTimeout, 3000);
+    sock->disconnect();
+    close(listenFd);
+}
+
+TEST(socket, ipv6)
+{
+    int          fd = socket(AF_INET6, SOCK_STREAM, 0);
+    sockaddr_in6 addr {};
+    addr.sin6_family = AF_INET6;
+    addr.sin6_addr   = in6addr_loopback;
+    socklen_t len    = sizeof(addr);
+    if (bind(fd, reinterpret_cast<sockaddr *>(&addr), len) == -1) {
+        close(fd);
+        GTEST_SKIP() << "no ipv6 loopback";
+    }
+    listen(fd, 1);
+    getsockname(fd, reinterpret_cast<sockaddr *>(&addr), &len);
+
+    auto [peer, spent] = connectTo("::1", ntohs(addr.sin6_port));
+    ASSERT_EQ(peer, "::1");
+    close(fd);
+}
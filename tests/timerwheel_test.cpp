@@ -0,0 +1,86 @@
+#include <gtest/gtest.h>
+#include <random>
+#include <vector>
+
+#include "timerwheel.h"
+
+TEST(timerwheel, fires_in_order)
+{
+    TM::TimerWheel   wheel(1000);
+    std::vector<int> fired;
+    wheel.schedule(1010, [&]() { fired.push_back(2); });
+    wheel.schedule(1005, [&]() { fired.push_back(1); });
+    wheel.schedule(1000 + 70000, [&]() { fired.push_back(3); });
+
+    ASSERT_EQ(wheel.nextExpiry(), 1005);
+    wheel.advance(1004);
+    ASSERT_TRUE(fired.empty());
+    wheel.advance(1010);
+    ASSERT_EQ(fired, (std::vector<int> { 1, 2 }));
+    wheel.advance(1000 + 69999);
+    ASSERT_EQ(fired.size(), 2);
+    wheel.advance(1000 + 70000);
+    ASSERT_EQ(fired, (std::vector<int> { 1, 2, 3 }));
+    ASSERT_EQ(wheel.size(), 0);
+    ASSERT_EQ(wheel.nextExpiry(), TM::TimerWheel::NoTimers);
+}
+
+TEST(timerwheel, cancel)
+{
+    TM::TimerWheel wheel;
+    bool           fired = false;
+    auto           id    = wheel.schedule(300, [&]() { fired = true; });
+    ASSERT_TRUE(wheel.cancel(id));
+    ASSERT_FALSE(wheel.cancel(id));
+    wheel.advance(1000);
+    ASSERT_FALSE(fired);
+
+    // stale id must not cancel a reused node
+    auto id2 = wheel.schedule(1500, [&]() { fired = true; });
+    ASSERT_FALSE(wheel.cancel(id));
+    wheel.advance(1500);
+    ASSERT_TRUE(fired);
+    ASSERT_FALSE(wheel.cancel(id2));
+}
+
+TEST(timerwheel, schedule_from_callback)
+{
+    TM::TimerWheel        wheel;
+    int                   count = 0;
+    std::function<void()> tick  = [&]() {
+        if (++count < 3)
+            wheel.schedule(0, tick); // overdue, fires on the next tick
+    };
+    wheel.schedule(10, tick);
+    wheel.advance(10);
+    ASSERT_EQ(count, 1);
+    wheel.advance(12);
+    ASSERT_EQ(count, 3);
+}
+
+TEST(timerwheel, random_stress)
+{
+    TM::TimerWheel                               wheel;
+    std::mt19937                                 rng(42);
+    std::uniform_int_distribution<std::uint64_t> dist(0, 1 << 20);
+    std::vector<std::uint64_t>                   expected;
+    std::uint64_t                                last    = 0;
+    bool                                         ordered = true;
+
+    for (int i = 0; i < 100000; i++) {
+        auto at = dist(rng);
+        auto id = wheel.schedule(at, [&, at]() {
+            ordered &= at >= last;
+            last = at;
+        });
+        if (i % 3 == 0)
+            wheel.cancel(id);
+    }
+    ASSERT_EQ(wheel.size(), 66666);
+    for (std::uint64_t now = 0; wheel.size(); now += 777) {
+        ASSERT_LE(wheel.nextExpiry(), now + 777 + 255);
+        wheel.advance(now);
+        ASSERT_LE(last, now);
+    }
+    ASSERT_TRUE(ordered);
+}
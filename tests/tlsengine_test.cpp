@@ -0,0 +1,94 @@
+#include <gtest/gtest.h>
+#include <string>
+
+#include <openssl/ec.h>
+#include <openssl/evp.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+
+#include "tlscontext.h"
+#include "tlsengine.h"
+
+// server side context with a self-signed certificate
+static SSL_CTX *serverContext()
+{
+    auto ctx = SSL_CTX_new(TLS_server_method());
+
+    EVP_PKEY *key  = nullptr;
+    auto      pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr);
+    EVP_PKEY_keygen_init(pctx);
+    EVP_PKEY_CTX_set_ec_paramgen_curve_nid(pctx, NID_X9_62_prime256v1);
+    EVP_PKEY_keygen(pctx, &key);
+    EVP_PKEY_CTX_free(pctx);
+
+    X509 *cert = X509_new();
+    ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+    X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+    X509_gmtime_adj(X509_getm_notAfter(cert), 3600);
+    X509_set_pubkey(cert, key);
+    auto name = X509_get_subject_name(cert);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+                               reinterpret_cast<const unsigned char *>("localhost"), -1, -1, 0);
+    X509_set_issuer_name(cert, name);
+    X509_sign(cert, key, EVP_sha256());
+    SSL_CTX_use_certificate(ctx, cert);
+    SSL_CTX_use_PrivateKey(ctx, key);
+    X509_free(cert);
+    EVP_PKEY_free(key);
+    return ctx;
+}
+
+// the records change hands without being copied
+static void pump(TM::TlsEngine &from, TM::TlsEngine &to)
+{
+    to.input().append(from.output());
+    from.output().clear();
+}
+
+TEST(tlsengine, memory_pipe)
+{
+    TM::TlsContext clientContext;
+    auto           serverCtx = serverContext();
+    TM::TlsEngine  client(SSL_new(clientContext.handle()));
+    TM::TlsEngine  server(SSL_new(serverCtx));
+    SSL_set_connect_state(client.handle());
+    SSL_set_accept_state(server.handle());
+
+    // a flight of each side at a time
+    for (int i = 0; i < 3; i++) {
+        SSL_do_handshake(client.handle());
+        pump(client, server);
+        SSL_do_handshake(server.handle());
+        pump(server, client);
+    }
+    ASSERT_TRUE(SSL_is_init_finished(client.handle()));
+    ASSERT_TRUE(SSL_is_init_finished(server.handle()));
+
+    ASSERT_EQ(SSL_write(client.handle(), "ping", 4), 4);
+    pump(client, server);
+    char buf[16];
+    ASSERT_EQ(SSL_read(server.handle(), buf, sizeof(buf)), 4);
+    ASSERT_EQ(std::string(buf, 4), "ping");
+
+    // output is taken up to the limit, then openssl is asked to retry
+    SSL_set_mode(server.handle(), SSL_MODE_ENABLE_PARTIAL_WRITE);
+    std::string big(4 * TM::TlsEngine::OutputLimit, 'x');
+    std::size_t len = 0;
+    int         ret;
+    while ((ret = SSL_write(server.handle(), big.data() + len, int(big.size() - len))) > 0)
+        len += std::size_t(ret);
+    ASSERT_EQ(SSL_get_error(server.handle(), ret), SSL_ERROR_WANT_WRITE);
+    ASSERT_LT(len, big.size());
+    ASSERT_GE(server.output().size(), TM::TlsEngine::OutputLimit);
+
+    // all of it is readable once delivered
+    pump(server, client);
+    std::string received;
+    int         n;
+    while ((n = SSL_read(client.handle(), buf, sizeof(buf))) > 0)
+        received.append(buf, std::size_t(n));
+    ASSERT_EQ(SSL_get_error(client.handle(), n), SSL_ERROR_WANT_READ);
+    ASSERT_EQ(received.size(), len);
+
+    SSL_CTX_free(serverCtx);
+}
@@ -20,4 +20,12 @@ TEST(url, parse_good_just_host)
     ASSERT_EQ(u.uri(), "");
 }
 
+TEST(url, parse_ipv6)
+{
+    TM::Url u("http://[::1]:8080/path");
+    ASSERT_EQ(u.host(), "::1");
+    ASSERT_EQ(u.port(), 8080);
+    ASSERT_EQ(u.uri(), "/path");
+}
+
 TEST(url, parse_bad) { ASSERT_THROW(TM::Url("htps://hello"), std::invalid_argument); }
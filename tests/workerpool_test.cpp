@@ -0,0 +1,57 @@
+#include <atomic>
+#include <gtest/gtest.h>
+#include <thread>
+
+#include "reactor.h"
+#include "workerpool.h"
+
+TEST(workerpool, done_on_reactor)
+{
+    auto            reactor = TM::Reactor::factory("epoll");
+    TM::WorkerPool  pool(2);
+    std::thread::id jobThread;
+    std::thread::id doneThread;
+
+    ASSERT_TRUE(pool.submit(
+        reactor, [&]() { jobThread = std::this_thread::get_id(); },
+        [&]() {
+            doneThread = std::this_thread::get_id();
+            reactor->stop();
+        }));
+    reactor->start();
+
+    ASSERT_NE(jobThread, std::thread::id());
+    ASSERT_NE(jobThread, std::this_thread::get_id());
+    ASSERT_EQ(doneThread, std::this_thread::get_id());
+}
+
+TEST(workerpool, bounded_queue)
+{
+    auto              reactor = TM::Reactor::factory("epoll");
+    TM::WorkerPool    pool(1, 2);
+    std::atomic<bool> release { false };
+    std::atomic<int>  started { 0 };
+    int               done = 0;
+
+    auto job = [&]() {
+        started++;
+        while (!release)
+            std::this_thread::yield();
+    };
+    auto finished = [&]() {
+        if (++done == 3)
+            reactor->stop();
+    };
+    ASSERT_TRUE(pool.submit(reactor, job, finished));
+    while (!started)
+        std::this_thread::yield();
+    // the only worker is busy, two more fit the queue
+    ASSERT_TRUE(pool.submit(reactor, job, finished));
+    ASSERT_TRUE(pool.submit(reactor, job, finished));
+    ASSERT_FALSE(pool.submit(reactor, job, finished));
+    ASSERT_EQ(pool.queued(), 2);
+
+    release = true;
+    reactor->start();
+    ASSERT_EQ(done, 3);
+}